@@ -0,0 +1,413 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <linux/hidraw.h>
+
+#include "log.h"
+#include "device.h"
+#include "cache.h"
+
+#ifndef XKEYSD_VERSION
+#define XKEYSD_VERSION "unknown"
+#endif
+
+/* maps a whole file read only, returns NULL if it's empty or missing */
+static void *map_file(const char *filename, size_t *size)
+{
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+	*size = st.st_size;
+	return map;
+}
+
+/* 64 bit FNV-1a of the configuration file */
+static int config_hash(const char *config, uint64_t *hash)
+{
+	const unsigned char *p;
+	size_t size, i;
+	uint64_t h = 14695981039346656037ULL;
+
+	p = map_file(config, &size);
+	if (p == NULL)
+		return 1;
+	for (i = 0; i < size; i++) {
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+	munmap((void *)p, size);
+	*hash = h;
+	return 0;
+}
+
+static void header_init(struct cache_header *header, uint64_t hash)
+{
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+	header->version = CACHE_VERSION;
+	snprintf(header->daemon_version, sizeof(header->daemon_version), "%s",
+		 XKEYSD_VERSION);
+	header->config_hash = hash;
+	header->device_size = sizeof(struct cache_device);
+	header->layer_size = sizeof(struct cache_layer);
+	header->event_size = sizeof(struct input_event);
+}
+
+static int load_macro(const struct cache_macro *cm,
+		      const struct input_event *events, uint32_t nevents,
+		      unsigned int nlayers, struct macro *macro)
+{
+	if (cm->layer_mode > LAYER_HOLD || cm->layer > nlayers)
+		return 1;
+	macro->layer_mode = cm->layer_mode;
+	macro->layer = cm->layer;
+	if (cm->npress + cm->nrelease == 0)
+		return 0;
+	if (cm->first > nevents ||
+	    cm->npress + cm->nrelease > nevents - cm->first ||
+	    cm->repeat > REPEAT_LAST ||
+	    cm->repeat_first > cm->npress ||
+	    (cm->repeat && (cm->npress < 2 || cm->repeat_interval == 0)))
+		return 1;
+	macro->ev = malloc((cm->npress + cm->nrelease) * sizeof(*macro->ev));
+	if (macro->ev == NULL)
+		return 1;
+	memcpy(macro->ev, &events[cm->first],
+	       (cm->npress + cm->nrelease) * sizeof(*macro->ev));
+	macro->npress = cm->npress;
+	macro->nrelease = cm->nrelease;
+	macro->repeat = cm->repeat;
+	macro->repeat_first = cm->repeat_first;
+	macro->repeat_delay = cm->repeat_delay;
+	macro->repeat_interval = cm->repeat_interval;
+	return 0;
+}
+
+static int load_gesture(const struct cache_gesture *cg,
+			const struct input_event *events, uint32_t nevents,
+			struct macro *macro)
+{
+	struct gesture *g;
+
+	if (cg->hold.npress == 0 && cg->dtap.npress == 0)
+		return 0;
+	if (macro->repeat || macro->layer_mode || cg->hold.repeat ||
+	    cg->dtap.repeat || cg->hold.layer_mode || cg->dtap.layer_mode ||
+	    cg->hold_time == 0 || cg->double_time == 0)
+		return 1;
+	g = calloc(1, sizeof(*g));
+	if (g == NULL)
+		return 1;
+	macro->gesture = g;
+	g->hold_time = cg->hold_time;
+	g->double_time = cg->double_time;
+	return load_macro(&cg->hold, events, nevents, 0, &g->hold) ||
+	       load_macro(&cg->dtap, events, nevents, 0, &g->dtap);
+}
+
+static int load_layer(const struct cache_layer *cl,
+		      const struct input_event *events, uint32_t nevents,
+		      unsigned int nlayers, struct mapping *mapping)
+{
+	int k;
+
+	memcpy(mapping->name, cl->name, sizeof(mapping->name));
+	mapping->name[sizeof(mapping->name) - 1] = 0;
+	mapping->axles[0] = cl->axles[0];
+	mapping->axles[1] = cl->axles[1];
+	for (k = 0; k < XKEYS_MAX_KEYS; k++)
+		if (load_macro(&cl->keys[k], events, nevents, nlayers,
+			       &mapping->keys[k]) ||
+		    load_gesture(&cl->gestures[k], events, nevents,
+				 &mapping->keys[k]))
+			return 1;
+	return 0;
+}
+
+/*
+ * fills 'devs' from the cache if it was made from the current contents of
+ * the configuration file. returns 1 if the configuration has to be parsed
+ */
+int cache_load(const char *filename, const char *config, struct device *devs,
+	       int *count)
+{
+	const struct cache_header *header;
+	const struct cache_device *cdev;
+	const struct cache_layer *layers;
+	const struct input_event *events;
+	struct cache_header expected;
+	struct mapping *mapping;
+	struct device *dev;
+	uint32_t nlayers = 0;
+	uint64_t hash;
+	size_t size;
+	void *map;
+	int i, l, ret = 1;
+
+	if (config_hash(config, &hash))
+		return 1;
+	map = map_file(filename, &size);
+	if (map == NULL)
+		return 1;
+
+	header = map;
+	header_init(&expected, hash);
+	if (size < sizeof(*header) ||
+	    memcmp(header, &expected, offsetof(struct cache_header, ndevices)) ||
+	    header->ndevices > HIDRAW_MAX_DEVICES ||
+	    header->nlayers > HIDRAW_MAX_DEVICES * (MAX_LAYERS - 1) ||
+	    size != sizeof(*header) + header->ndevices * sizeof(*cdev) +
+		    header->nlayers * sizeof(*layers) +
+		    (size_t)header->nevents * sizeof(*events))
+		goto out;
+
+	cdev = (const struct cache_device *)(header + 1);
+	layers = (const struct cache_layer *)(cdev + header->ndevices);
+	events = (const struct input_event *)(layers + header->nlayers);
+	for (i = 0; i < header->ndevices; i++, cdev++) {
+		dev = &devs[i];
+		memset(dev, 0, sizeof(*dev));
+		dev->id = i;
+		dev->fd = -1;
+		dev->uinput = -1;
+		dev->hidraw = -1;
+		dev->event = -1;
+		dev->method = cdev->method;
+		memcpy(dev->filename, cdev->filename, sizeof(dev->filename));
+		memcpy(dev->name, cdev->name, sizeof(dev->name));
+		memcpy(dev->serial, cdev->serial, sizeof(dev->serial));
+		dev->vendor = cdev->vendor;
+		dev->product = cdev->product;
+		dev->sinks = cdev->sinks;
+		memcpy(dev->ring_name, cdev->ring_name, sizeof(dev->ring_name));
+		dev->ring_name[sizeof(dev->ring_name) - 1] = 0;
+		dev->ring_size = cdev->ring_size;
+
+		dev->mapping = calloc(1, sizeof(*dev->mapping));
+		if (dev->mapping == NULL)
+			goto err;
+		dev->active = dev->mapping;
+		*count = i + 1;
+		if (dev->sinks == 0 ||
+		    dev->sinks > (SINK_UINPUT | SINK_RING) ||
+		    ((dev->sinks & SINK_RING) &&
+		     (dev->ring_size < RING_MIN_SIZE ||
+		      dev->ring_size > RING_MAX_SIZE ||
+		      (dev->ring_size & (dev->ring_size - 1)))) ||
+		    cdev->nlayers >= MAX_LAYERS ||
+		    cdev->nlayers > header->nlayers - nlayers ||
+		    load_layer(&cdev->base, events, header->nevents,
+			       cdev->nlayers, dev->mapping))
+			goto err;
+		for (l = 0; l < cdev->nlayers; l++) {
+			mapping = calloc(1, sizeof(*mapping));
+			if (mapping == NULL)
+				goto err;
+			dev->mapping->layers[l] = mapping;
+			dev->mapping->nlayers = l + 1;
+			if (load_layer(&layers[nlayers++], events,
+				       header->nevents, cdev->nlayers, mapping))
+				goto err;
+		}
+	}
+	if (nlayers != header->nlayers)
+		goto err;
+	*count = header->ndevices;
+	ret = 0;
+	goto out;
+err:
+	log_err("Invalid configuration cache %s, ignoring it\n", filename);
+	for (i = 0; i < *count; i++) {
+		mapping_free(devs[i].mapping);
+		devs[i].mapping = NULL;
+	}
+	*count = 0;
+out:
+	munmap(map, size);
+	return ret;
+}
+
+static int write_all(int fd, const void *buf, size_t size)
+{
+	return write(fd, buf, size) != size;
+}
+
+static void save_macro(struct cache_macro *cm, const struct macro *macro,
+		       uint32_t *nevents)
+{
+	cm->first = *nevents;
+	cm->npress = macro->npress;
+	cm->nrelease = macro->nrelease;
+	cm->repeat = macro->repeat;
+	cm->repeat_first = macro->repeat_first;
+	cm->repeat_delay = macro->repeat_delay;
+	cm->repeat_interval = macro->repeat_interval;
+	cm->layer_mode = macro->layer_mode;
+	cm->layer = macro->layer;
+	*nevents += macro->npress + macro->nrelease;
+}
+
+static int write_macro(int fd, const struct macro *macro)
+{
+	return write_all(fd, macro->ev, (macro->npress + macro->nrelease) *
+					sizeof(*macro->ev));
+}
+
+/* the events go in the same order they're written: key, hold, double tap */
+static void save_layer(struct cache_layer *cl, const struct mapping *mapping,
+		       uint32_t *nevents)
+{
+	const struct macro *macro;
+	int k;
+
+	memcpy(cl->name, mapping->name, sizeof(cl->name));
+	cl->axles[0] = mapping->axles[0];
+	cl->axles[1] = mapping->axles[1];
+	for (k = 0; k < XKEYS_MAX_KEYS; k++) {
+		macro = &mapping->keys[k];
+		save_macro(&cl->keys[k], macro, nevents);
+		if (macro->gesture == NULL)
+			continue;
+		save_macro(&cl->gestures[k].hold, &macro->gesture->hold, nevents);
+		save_macro(&cl->gestures[k].dtap, &macro->gesture->dtap, nevents);
+		cl->gestures[k].hold_time = macro->gesture->hold_time;
+		cl->gestures[k].double_time = macro->gesture->double_time;
+	}
+}
+
+static int write_layer(int fd, const struct mapping *mapping)
+{
+	const struct macro *macro;
+	int k;
+
+	for (k = 0; k < XKEYS_MAX_KEYS; k++) {
+		macro = &mapping->keys[k];
+		if (write_macro(fd, macro) ||
+		    (macro->gesture &&
+		     (write_macro(fd, &macro->gesture->hold) ||
+		      write_macro(fd, &macro->gesture->dtap))))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * writes the parsed configuration to the cache. the file is replaced with
+ * a rename, so a cache being read is never seen half written
+ */
+int cache_save(const char *filename, const char *config,
+	       const struct device *devs, int count)
+{
+	struct cache_header header;
+	struct cache_device *cdevs;
+	struct cache_layer *layers;
+	const struct mapping *mapping;
+	char tmp[PATH_MAX];
+	uint32_t nevents = 0, nlayers = 0;
+	uint64_t hash;
+	int fd, i, l, ret = 1;
+
+	if (config_hash(config, &hash))
+		return 1;
+
+	for (i = 0; i < count; i++)
+		nlayers += devs[i].mapping->nlayers;
+	cdevs = calloc(count, sizeof(*cdevs));
+	layers = calloc(nlayers, sizeof(*layers));
+	if ((cdevs == NULL && count) || (layers == NULL && nlayers)) {
+		free(cdevs);
+		free(layers);
+		return 1;
+	}
+	nlayers = 0;
+	for (i = 0; i < count; i++) {
+		memcpy(cdevs[i].filename, devs[i].filename, sizeof(cdevs[i].filename));
+		memcpy(cdevs[i].name, devs[i].name, sizeof(cdevs[i].name));
+		memcpy(cdevs[i].serial, devs[i].serial, sizeof(cdevs[i].serial));
+		cdevs[i].vendor = devs[i].vendor;
+		cdevs[i].product = devs[i].product;
+		cdevs[i].method = devs[i].method;
+		cdevs[i].sinks = devs[i].sinks;
+		memcpy(cdevs[i].ring_name, devs[i].ring_name,
+		       sizeof(cdevs[i].ring_name));
+		cdevs[i].ring_size = devs[i].ring_size;
+		mapping = devs[i].mapping;
+		cdevs[i].nlayers = mapping->nlayers;
+		save_layer(&cdevs[i].base, mapping, &nevents);
+		for (l = 0; l < mapping->nlayers; l++)
+			save_layer(&layers[nlayers++], mapping->layers[l], &nevents);
+	}
+	header_init(&header, hash);
+	header.ndevices = count;
+	header.nlayers = nlayers;
+	header.nevents = nevents;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		log_err("Unable to write configuration cache %s (%s)\n", tmp,
+			strerror(errno));
+		free(cdevs);
+		free(layers);
+		return 1;
+	}
+	if (write_all(fd, &header, sizeof(header)) ||
+	    write_all(fd, cdevs, count * sizeof(*cdevs)) ||
+	    write_all(fd, layers, nlayers * sizeof(*layers)))
+		goto out;
+	for (i = 0; i < count; i++)
+		for (l = 0; l <= devs[i].mapping->nlayers; l++)
+			if (write_layer(fd, mapping_layer(devs[i].mapping, l)))
+				goto out;
+	ret = 0;
+out:
+	if (close(fd))
+		ret = 1;
+	if (!ret && rename(tmp, filename))
+		ret = 1;
+	if (ret) {
+		log_err("Unable to write configuration cache %s (%s)\n",
+			filename, strerror(errno));
+		unlink(tmp);
+	}
+	free(cdevs);
+	free(layers);
+	return ret;
+}
@@ -0,0 +1,94 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef CACHE_H
+#define CACHE_H
+#include <stdint.h>
+
+#include "device.h"
+
+/*
+ * the configuration is parsed once and the resulting tables are kept in a
+ * cache file, so later starts only have to map it. the layout is a header,
+ * one entry per device, the layers of every device besides its base one in
+ * the same order and then the events of every macro, which the devices
+ * refer to by position. it's in host byte order and is only used
+ * by the same xkeysd version, for the exact configuration file it was
+ * made from
+ */
+#define CACHE_MAGIC	"XKCC"
+#define CACHE_VERSION	8
+
+struct cache_header {
+	char magic[4];
+	uint32_t version;
+	char daemon_version[16];
+	uint64_t config_hash;	/* of the configuration file contents */
+	uint32_t device_size;	/* sizeof(struct cache_device) */
+	uint32_t layer_size;	/* sizeof(struct cache_layer) */
+	uint32_t event_size;	/* sizeof(struct input_event) */
+	uint32_t ndevices;
+	uint32_t nlayers;
+	uint32_t nevents;
+};
+
+struct cache_macro {
+	uint32_t first;		/* position of its first event */
+	uint16_t npress;
+	uint16_t nrelease;
+	uint16_t repeat;
+	uint16_t repeat_first;
+	uint16_t repeat_delay;
+	uint16_t repeat_interval;
+	uint16_t layer_mode;
+	uint16_t layer;
+};
+
+/* a key has gestures if either macro has events */
+struct cache_gesture {
+	struct cache_macro hold;
+	struct cache_macro dtap;
+	uint16_t hold_time;
+	uint16_t double_time;
+};
+
+struct cache_layer {
+	char name[LAYER_NAME_SIZE];
+	uint16_t axles[2];
+	struct cache_macro keys[XKEYS_MAX_KEYS];
+	struct cache_gesture gestures[XKEYS_MAX_KEYS];
+};
+
+struct cache_device {
+	char filename[128];
+	char name[64];
+	char serial[64];
+	uint16_t vendor;
+	uint16_t product;
+	uint16_t method;
+	uint16_t sinks;
+	char ring_name[RING_NAME_SIZE];
+	uint32_t ring_size;
+	uint16_t nlayers;	/* besides the base one */
+	struct cache_layer base;
+};
+
+int cache_load(const char *filename, const char *config, struct device *devs,
+	       int *count);
+int cache_save(const char *filename, const char *config,
+	       const struct device *devs, int count);
+#endif	/* CACHE_H */
@@ -0,0 +1,186 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <grp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "log.h"
+#include "loop.h"
+#include "control.h"
+
+struct control_client {
+	struct loop_source source;
+	int fd;
+};
+
+static struct loop_source control_source;
+static control_cb control_callback;
+static int control_fd = -1;
+static int nclients;
+
+static void client_close(struct control_client *client)
+{
+	loop_del(client->fd);
+	close(client->fd);
+	free(client);
+	nclients--;
+}
+
+/* splits the request in place and sends back what the command wrote */
+static int run_request(struct control_client *client, char *buf)
+{
+	char *argv[CONTROL_MAX_ARGS], *reply, *save;
+	int argc = 0, ret = 1;
+	size_t size;
+	FILE *f;
+
+	f = open_memstream(&reply, &size);
+	if (f == NULL)
+		return 1;
+	for (argv[0] = strtok_r(buf, " \t\n", &save);
+	     argv[argc] && argc < CONTROL_MAX_ARGS - 1;
+	     argv[argc] = strtok_r(NULL, " \t\n", &save))
+		argc++;
+	if (argc == 0)
+		fprintf(f, "empty request\n");
+	else if (argv[argc])
+		fprintf(f, "too many arguments\n");
+	else
+		ret = control_callback(argc, argv, f);
+	fclose(f);
+
+	/* the status goes in front, the output is cut to a single message */
+	if (size > CONTROL_MSG_SIZE - 8)
+		size = CONTROL_MSG_SIZE - 8;
+	memmove(buf, ret ? "error\n" : "ok\n", ret ? 6 : 3);
+	memcpy(buf + (ret ? 6 : 3), reply, size);
+	free(reply);
+
+	/* a client that doesn't read its replies isn't waited for */
+	if (send(client->fd, buf, size + (ret ? 6 : 3),
+		 MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+		return 1;
+	return 0;
+}
+
+static int client_input(struct loop_source *source)
+{
+	struct control_client *client;
+	char buf[CONTROL_MSG_SIZE];
+	ssize_t size;
+
+	client = container_of(source, struct control_client, source);
+	size = recv(client->fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+	if (size < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	if (size <= 0) {
+		client_close(client);
+		return 0;
+	}
+	buf[size] = 0;
+	if (run_request(client, buf))
+		client_close(client);
+	return 0;
+}
+
+static int control_input(struct loop_source *source)
+{
+	struct control_client *client;
+	int fd;
+
+	while (1) {
+		fd = accept4(control_fd, NULL, NULL,
+			     SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				log_err("Error accepting control connection (%s)\n",
+					strerror(errno));
+			break;
+		}
+		client = calloc(1, sizeof(*client));
+		if (nclients == CONTROL_MAX_CLIENTS || client == NULL) {
+			free(client);
+			close(fd);
+			continue;
+		}
+		client->fd = fd;
+		client->source.handler = client_input;
+		if (loop_add(fd, &client->source)) {
+			free(client);
+			close(fd);
+			continue;
+		}
+		nclients++;
+	}
+	return 0;
+}
+
+/*
+ * a socket left behind by a previous run is replaced. only the user running
+ * the daemon can connect, and the members of 'group' if there's one
+ */
+int control_init(const char *path, const char *group, control_cb cb)
+{
+	struct sockaddr_un addr;
+	struct group *grp = NULL;
+	mode_t mask;
+	int ret;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		log_err("Control socket path %s is too long\n", path);
+		return 1;
+	}
+	strcpy(addr.sun_path, path);
+	if (group && (grp = getgrnam(group)) == NULL) {
+		log_err("Unknown group %s for the control socket\n", group);
+		return 1;
+	}
+
+	control_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (control_fd < 0) {
+		log_err("Error creating control socket (%s)\n", strerror(errno));
+		return 1;
+	}
+	unlink(path);
+	/* the group only gets access once the socket is theirs */
+	mask = umask(0177);
+	ret = bind(control_fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+	if (!ret && grp)
+		ret = chown(path, -1, grp->gr_gid) || chmod(path, 0660);
+	if (ret || listen(control_fd, CONTROL_MAX_CLIENTS)) {
+		log_err("Error setting up control socket %s (%s)\n", path,
+			strerror(errno));
+		close(control_fd);
+		control_fd = -1;
+		return 1;
+	}
+
+	control_callback = cb;
+	control_source.handler = control_input;
+	return loop_add(control_fd, &control_source);
+}
@@ -0,0 +1,36 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef CONTROL_H
+#define CONTROL_H
+#include <stdio.h>
+
+/*
+ * local control socket, SOCK_SEQPACKET so every request and reply is a
+ * single message. a request is a command and its arguments separated by
+ * spaces, the reply is "ok" or "error" on the first line followed by the
+ * output of the command. xkeysctl is the client
+ */
+#define CONTROL_MSG_SIZE	32768
+#define CONTROL_MAX_ARGS	8
+#define CONTROL_MAX_CLIENTS	16
+
+/* runs a command, writing its output to 'reply'. returns 1 on error */
+typedef int (*control_cb)(int argc, char **argv, FILE *reply);
+
+int control_init(const char *path, const char *group, control_cb cb);
+#endif	/* CONTROL_H */
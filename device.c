@@ -0,0 +1,1326 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include <sys/ioctl.h>
+
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+#include "log.h"
+#include "device.h"
+#include "record.h"
+#include "uring.h"
+#include "macro.h"
+#include "timer.h"
+
+static void macro_append(struct macro *macro, unsigned int *size, uint16_t type,
+			 uint16_t code, int32_t value)
+{
+	struct input_event *ev;
+	unsigned int n = macro->npress + macro->nrelease;
+
+	if (n == *size) {
+		*size = *size ? *size * 2 : 16;
+		ev = realloc(macro->ev, *size * sizeof(*ev));
+		if (ev == NULL) {
+			log_err("Not enought memory\n");
+			exit(1);
+		}
+		macro->ev = ev;
+	}
+	ev = &macro->ev[n];
+	memset(ev, 0, sizeof(*ev));
+	ev->type = type;
+	ev->code = code;
+	ev->value = value;
+	macro->npress++;
+}
+
+static void macro_append_block(struct macro *macro, unsigned int *size,
+			       uint16_t *codes, int count, int value)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		macro_append(macro, size, EV_KEY, codes[i], value);
+	macro_append(macro, size, EV_SYN, SYN_REPORT, 1);
+}
+
+/* returns 1 if the token is a delay, like "100ms" */
+static int parse_delay(const char *token, unsigned int *delay)
+{
+	char unit[4];
+
+	if (!isdigit(*token) || sscanf(token, "%u%3s", delay, unit) != 2 ||
+	    strcmp(unit, "ms"))
+		return 0;
+	return 1;
+}
+
+/*
+ * key config format works like this:
+ * key12 = KEY_LEFTALT+KEY_T;KEY_LEFTCTRL+KEY_LEFTALT+KEY_DELETE;KEY_A
+ * will generate alt+t, ctrl+alt+del, a
+ * everything in one block (delimited by ';') will be pressed then
+ * released at the same time. this means that each ";" represents a
+ * "release all keys". This means that:
+ *	key12 = KEY_LEFTCTRL;KEY_LEFTALT;KEY_DELETE
+ * is different from
+ * 	key12 = KEY_LEFTCTRL+KEY_LEFTALT+KEY_DELETE
+ * in the sense that the former will press and release each of the
+ * keys separately while the last will press all of them then release
+ * all of them.
+ *
+ * a single block is pressed when the physical key is pressed and released
+ * when it is released. multiple blocks are pressed and released in
+ * sequence when the physical key is pressed, nothing is sent on release.
+ *
+ * a step of a sequence can be a delay instead, in ms:
+ *	key12 = KEY_LEFTCTRL+KEY_C;50ms;KEY_LEFTCTRL+KEY_V
+ * copies, waits 50ms and then pastes, with the other keys and devices
+ * being handled meanwhile. a delay makes a sequence of a single block too
+ *
+ * The limit of keys pressed is controlled by MAX_PRESSED_KEYS
+ */
+int compile_macro(struct input_translate *priv, char *value,
+			 struct macro *macro)
+{
+	const char *delim1 = ";", *delim2 = "+";
+	char *tmp1, *tmp2, *saved1, *saved2, *token;
+	struct input_translate_type event;
+	uint16_t codes[MAX_PRESSED_KEYS];
+	unsigned int size = 0, last = 0;
+	int j = 0, blocks = 0, delays = 0, held = 0;
+	unsigned int delay;
+
+	memset(macro, 0, sizeof(*macro));
+	for (tmp1 = value; ; tmp1 = NULL) {
+		token = strtok_r(tmp1, delim1, &saved1);
+		if (token == NULL)
+			break;
+
+		/* the previous block is released before the next step */
+		if (held)
+			macro_append_block(macro, &size, codes, j, 0);
+		held = 0;
+
+		if (parse_delay(token, &delay)) {
+			if (delay > MACRO_MAX_DELAY) {
+				log_err("Delay %s is too long, maximum is %ims\n",
+					token, MACRO_MAX_DELAY);
+				return 1;
+			}
+			macro_append(macro, &size, EV_SYN, MACRO_DELAY, delay);
+			delays++;
+			continue;
+		}
+
+		for (j = 0, tmp2 = token; ; tmp2 = NULL, j++) {
+			token = strtok_r(tmp2, delim2, &saved2);
+			if (token == NULL)
+				break;
+
+			if (input_translate_string(priv, token, &event)) {
+				log_err("Unable to parse key %s\n", token);
+				return 1;
+			}
+			if (event.type != EV_KEY) {
+				log_err("Event %s is not supported yet, only KEY_ events\n", token);
+				return 1;
+			}
+			if (j >= MAX_PRESSED_KEYS) {
+				log_err("Maximum of pressed keys reached (%i)\n", MAX_PRESSED_KEYS);
+				return 1;
+			}
+			codes[j] = event.code;
+		}
+		last = macro->npress;
+		macro_append_block(macro, &size, codes, j, 1);
+		blocks++;
+		held = 1;
+	}
+	if (blocks == 0) {
+		if (delays) {
+			log_err("A delay needs keys to go with it\n");
+			return 1;
+		}
+		return 0;
+	}
+
+	if (blocks == 1 && !delays) {
+		/* single block: release happens with the physical key */
+		macro_append_block(macro, &size, codes, j, 0);
+		macro->npress -= j + 1;
+		macro->nrelease = j + 1;
+	} else if (held)
+		macro_append_block(macro, &size, codes, j, 0);
+	macro->repeat_first = last;
+
+	return 0;
+}
+
+void mapping_free(struct mapping *mapping)
+{
+	int i;
+
+	if (mapping == NULL)
+		return;
+	for (i = 0; i < XKEYS_MAX_KEYS; i++) {
+		free(mapping->keys[i].ev);
+		if (mapping->keys[i].gesture) {
+			free(mapping->keys[i].gesture->hold.ev);
+			free(mapping->keys[i].gesture->dtap.ev);
+			free(mapping->keys[i].gesture);
+		}
+	}
+	for (i = 0; i < mapping->nlayers; i++)
+		mapping_free(mapping->layers[i]);
+	free(mapping);
+}
+
+/* events go to uinput with write(), unless an I/O backend took over */
+static int output_write(struct device *dev, const struct input_event *ev,
+			unsigned int count)
+{
+	ssize_t size = count * sizeof(*ev);
+
+	if (dev->out.write)
+		return dev->out.write(dev, ev, count);
+	if (write(dev->uinput, ev, size) != size) {
+		log_err("Error writing events to uinput device (%s)\n", strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+int flush_input_events(struct device *dev)
+{
+	struct output_batch *out = &dev->out;
+
+	if (out->count == 0)
+		return 0;
+
+	if (output_write(dev, out->ev, out->count)) {
+		out->count = 0;
+		return 1;
+	}
+	out->flushes++;
+	out->events += out->count;
+	out->count = 0;
+	return 0;
+}
+
+static int _write_input_event(struct device *dev, uint16_t type, uint16_t code, int32_t value)
+{
+	struct output_batch *out = &dev->out;
+	struct input_event *ev;
+
+	if (out->count == OUTPUT_BATCH_SIZE && flush_input_events(dev))
+		return 1;
+
+	ev = &out->ev[out->count++];
+	memset(ev, 0, sizeof(*ev));
+	ev->type = type;
+	ev->code = code;
+	ev->value = value;
+	return 0;
+}
+
+static int queue_input_events(struct device *dev, const struct input_event *ev,
+			      unsigned int count)
+{
+	struct output_batch *out = &dev->out;
+
+	if (out->count + count > OUTPUT_BATCH_SIZE && flush_input_events(dev))
+		return 1;
+
+	if (count > OUTPUT_BATCH_SIZE) {
+		/* too big to be batched, send it straight away */
+		if (output_write(dev, ev, count))
+			return 1;
+		out->flushes++;
+		out->events += count;
+		return 0;
+	}
+
+	memcpy(&out->ev[out->count], ev, count * sizeof(*ev));
+	out->count += count;
+	return 0;
+}
+
+/*
+ * queues the events of a sequence from 'next' on, up to its next delay.
+ * what comes after the delay is left to the macro scheduler
+ */
+static int run_steps(struct device *dev, const struct macro *macro,
+		     unsigned int next)
+{
+	unsigned int i;
+
+	for (i = next; i < macro->npress; i++) {
+		if (macro->ev[i].type != EV_SYN ||
+		    macro->ev[i].code != MACRO_DELAY)
+			continue;
+		if (queue_input_events(dev, &macro->ev[next], i - next))
+			return 1;
+		next = i + 1;
+		if (!macro_schedule(dev, macro, next, macro->ev[i].value))
+			return 0;
+		/* no scheduler, the delay is skipped */
+	}
+	return queue_input_events(dev, &macro->ev[next], macro->npress - next);
+}
+
+static int run_macro(struct macro *macro, int value, struct device *dev)
+{
+	/* sequences have nothing to release, and may have delays */
+	if (value && macro->nrelease == 0)
+		return run_steps(dev, macro, 0);
+	if (value)
+		return queue_input_events(dev, macro->ev, macro->npress);
+	return queue_input_events(dev, macro->ev + macro->npress,
+				  macro->nrelease);
+}
+
+/* queues the motion summed up so far, the dials share a SYN_REPORT */
+static int flush_dials(struct device *dev)
+{
+	struct output_batch *out = &dev->out;
+	int32_t value;
+	int i, dials = 0;
+
+	/* shuttle first, in the order the reports are decoded */
+	for (i = 1; i >= 0; i--) {
+		value = out->dial[i];
+		if (value == 0)
+			continue;
+		out->dial[i] = 0;
+		if (dev->ring)
+			ring_publish(dev->ring, RING_EVENT_DIAL, i, value);
+		if (dev->uinput < 0)
+			continue;
+		if (_write_input_event(dev, EV_REL, dev->active->axles[i], value))
+			return 1;
+		dials++;
+	}
+	if (dials)
+		return _write_input_event(dev, EV_SYN, SYN_REPORT, 1);
+	return 0;
+}
+
+static int repeat_expired(struct timer *timer);
+
+/*
+ * the timers of a device are allocated the first time one is used. there
+ * are none without the main loop, like on replay
+ */
+static struct key_timer *key_timer(struct device *dev, unsigned int key)
+{
+	int i;
+
+	if (!timers_enabled())
+		return NULL;
+	if (dev->key_timers == NULL) {
+		dev->key_timers = calloc(XKEYS_MAX_KEYS, sizeof(*dev->key_timers));
+		if (dev->key_timers == NULL) {
+			log_err("Not enough memory for key timers\n");
+			return NULL;
+		}
+		for (i = 0; i < XKEYS_MAX_KEYS; i++) {
+			timer_setup(&dev->key_timers[i].timer, repeat_expired);
+			dev->key_timers[i].dev = dev;
+			dev->key_timers[i].key = i;
+		}
+	}
+	return &dev->key_timers[key];
+}
+
+static void key_timers_stop(struct device *dev)
+{
+	int i;
+
+	if (dev->key_timers == NULL)
+		return;
+	for (i = 0; i < XKEYS_MAX_KEYS; i++) {
+		timer_del(&dev->key_timers[i].timer);
+		dev->key_timers[i].state = GESTURE_IDLE;
+	}
+}
+
+/*
+ * the macro of a key comes from the layer it was pressed in, until it's
+ * released and done with its gestures, whatever the layer in use is now
+ */
+static inline struct macro *key_macro(struct device *dev, unsigned int key,
+				      int value)
+{
+	if (value && (dev->key_timers == NULL ||
+		      dev->key_timers[key].state == GESTURE_IDLE))
+		dev->key_layer[key] = dev->layer;
+	return &mapping_layer(dev->mapping, dev->key_layer[key])->keys[key];
+}
+
+/* switching layers only changes the table keys are looked up in */
+static void layer_action(struct device *dev, const struct macro *macro,
+			 int value)
+{
+	unsigned int layer = dev->layer;
+
+	switch (macro->layer_mode) {
+	case LAYER_SWITCH:
+		if (value)
+			dev->base_layer = layer = macro->layer;
+		break;
+	case LAYER_TOGGLE:
+		if (value)
+			dev->base_layer = layer =
+				dev->base_layer == macro->layer ? 0 : macro->layer;
+		break;
+	case LAYER_HOLD:
+		if (value)
+			layer = macro->layer;
+		else if (dev->layer == macro->layer)
+			layer = dev->base_layer;
+		break;
+	}
+	dev->layer = layer;
+	dev->active = mapping_layer(dev->mapping, layer);
+}
+
+/* starts or stops the auto-repeat of a key */
+static void key_repeat(struct device *dev, unsigned int key,
+		       const struct macro *macro, int value)
+{
+	struct key_timer *t;
+
+	if (!value) {
+		if (dev->key_timers)
+			timer_del(&dev->key_timers[key].timer);
+		return;
+	}
+	t = key_timer(dev, key);
+	if (t == NULL)
+		return;
+	t->timer.fn = repeat_expired;
+	timer_add(&t->timer, macro->repeat_delay);
+}
+
+static int tap_macro(struct device *dev, struct macro *macro)
+{
+	return run_macro(macro, 1, dev) || run_macro(macro, 0, dev);
+}
+
+static int gesture_expired(struct timer *timer);
+
+/*
+ * tells a tap from a hold and a double tap. a tap is sent on release when
+ * there's no double tap to wait for, the wait is never longer than
+ * double_time after the release
+ */
+static int key_gesture(struct device *dev, unsigned int key,
+		       struct macro *macro, int value)
+{
+	struct gesture *g = macro->gesture;
+	struct key_timer *t = key_timer(dev, key);
+
+	if (t == NULL)
+		return run_macro(macro, value, dev);
+	t->timer.fn = gesture_expired;
+
+	switch (t->state) {
+	case GESTURE_IDLE:
+		if (!value)
+			break;
+		t->state = GESTURE_DOWN;
+		if (g->hold.npress)
+			timer_add(&t->timer, g->hold_time);
+		break;
+	case GESTURE_DOWN:
+		if (value)
+			break;
+		timer_del(&t->timer);
+		if (g->dtap.npress) {
+			t->state = GESTURE_UP;
+			timer_add(&t->timer, g->double_time);
+			break;
+		}
+		t->state = GESTURE_IDLE;
+		return tap_macro(dev, macro);
+	case GESTURE_UP:
+		if (!value)
+			break;
+		timer_del(&t->timer);
+		t->state = GESTURE_DOUBLE;
+		return run_macro(&g->dtap, 1, dev);
+	case GESTURE_HELD:
+		if (value)
+			break;
+		t->state = GESTURE_IDLE;
+		return run_macro(&g->hold, 0, dev);
+	case GESTURE_DOUBLE:
+		if (value)
+			break;
+		t->state = GESTURE_IDLE;
+		return run_macro(&g->dtap, 0, dev);
+	}
+	return 0;
+}
+
+/* releases whatever a key held down has pressed, and its held layer */
+static void release_key(struct device *dev, unsigned int key)
+{
+	struct macro *macro = key_macro(dev, key, 0);
+
+	if (macro->gesture == NULL || dev->key_timers == NULL)
+		run_macro(macro, 0, dev);
+	else if (dev->key_timers[key].state == GESTURE_HELD)
+		run_macro(&macro->gesture->hold, 0, dev);
+	else if (dev->key_timers[key].state == GESTURE_DOUBLE)
+		run_macro(&macro->gesture->dtap, 0, dev);
+	if (macro->layer_mode == LAYER_HOLD)
+		layer_action(dev, macro, 0);
+}
+
+static inline int press_key(struct device *dev, unsigned int key, int value)
+{
+	struct macro *macro = key_macro(dev, key, value);
+
+	if (macro->gesture)
+		return key_gesture(dev, key, macro, value);
+	if (run_macro(macro, value, dev))
+		return 1;
+	if (macro->repeat)
+		key_repeat(dev, key, macro, value);
+	if (macro->layer_mode)
+		layer_action(dev, macro, value);
+	return 0;
+}
+
+/* runs the macros of the keys that changed since the last report */
+static inline __attribute__((always_inline))
+int decode_keys(struct device *dev, const uint64_t *keys, int words,
+		int *classes)
+{
+	struct report_state *last = &dev->last;
+	uint64_t changed;
+	int i, w;
+
+	for (w = 0; w < words; w++) {
+		/* stale keys were released already, their release is swallowed */
+		changed = (keys[w] ^ last->keys[w]) & ~last->stale[w];
+		last->stale[w] &= keys[w];
+		if (changed) {
+			*classes |= 1 << EVENT_CLASS_KEY;
+			/* motion from before the key changed goes first */
+			if (flush_dials(dev))
+				return 1;
+		}
+		for_each_changed_key(i, changed) {
+			if (dev->ring)
+				ring_publish(dev->ring, RING_EVENT_KEY, w * 64 + i,
+					     (keys[w] >> i) & 1);
+			/* without uinput there's nothing to run macros for */
+			if (dev->uinput >= 0 &&
+			    press_key(dev, w * 64 + i, (keys[w] >> i) & 1))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+/* latency is measured from the first report of the batch with events */
+static void batch_classes(struct device *dev, int classes, uint64_t start)
+{
+	if (classes && !dev->out.classes)
+		dev->out.start = start;
+	dev->out.classes |= classes;
+}
+
+/* the events of a batch are written, from its first report until now */
+void device_account(struct device *dev, int classes, uint64_t start)
+{
+	uint64_t elapsed = monotonic_ns() - start;
+	int i;
+
+	for (i = 0; i < EVENT_CLASSES; i++)
+		if (classes & (1 << i))
+			histogram_add(&dev->latency[i], elapsed);
+}
+
+/* writes out everything decoded since the batch started */
+static int finish_batch(struct device *dev)
+{
+	struct output_batch *out = &dev->out;
+	int ret;
+
+	ret = flush_dials(dev);
+	if (flush_input_events(dev))
+		ret = 1;
+	if (!ret && out->classes) {
+		if (out->account)
+			out->account(dev, out->classes, out->start);
+		else
+			device_account(dev, out->classes, out->start);
+	}
+	out->classes = 0;
+	return ret;
+}
+
+/*
+ * the decoding is written once, for any model, and always inlined into a
+ * routine per model below. with the model table known at compile time the
+ * loops over key bytes and words unroll, and the checks for dials the
+ * model doesn't have go away
+ */
+static inline __attribute__((always_inline))
+int decode_report(struct device *dev, const struct xkeys_model *model,
+		  const unsigned char *report, int size, uint64_t start)
+{
+	struct report_state *last = &dev->last;
+	int ret = 0, w, classes = 0;
+	uint64_t keys[XKEYS_KEY_WORDS];
+
+	if (size < model->report_size) {
+		log_err("Short report from hidraw device (%i bytes)\n", size);
+		return 0;
+	}
+
+	if (model->type_offset && report[model->type_offset] != model->type)
+		/* not a key/dial report */
+		return 0;
+	xkeys_pack_keys(model, report, keys);
+
+	if (!last->valid)
+		/* first run, ignore */
+		goto out;
+
+	/*
+	 * the dials are summed up with what came before in the batch, keys
+	 * that changed send that motion first and then run their macros.
+	 * the jog counter wraps, so the difference is taken modulo 256
+	 */
+	if (model->shuttle >= 0 && report[model->shuttle] != last->shuttle) {
+		dev->out.dial[1] += (signed char)(report[model->shuttle] -
+						   last->shuttle);
+		classes |= 1 << EVENT_CLASS_SHUTTLE;
+	}
+	if (model->jog >= 0 && report[model->jog] != last->jog) {
+		dev->out.dial[0] += (signed char)(report[model->jog] -
+						   last->jog);
+		classes |= 1 << EVENT_CLASS_JOG;
+	}
+	ret = decode_keys(dev, keys, XKEYS_WORDS(model->nkeys), &classes);
+
+out:
+	batch_classes(dev, classes, start);
+	if (model->shuttle >= 0)
+		last->shuttle = report[model->shuttle];
+	if (model->jog >= 0)
+		last->jog = report[model->jog];
+	for (w = 0; w < XKEYS_WORDS(model->nkeys); w++)
+		last->keys[w] = keys[w];
+	last->valid = 1;
+	return ret;
+}
+
+/*
+ * report layouts of the supported models, with the product id of their
+ * default endpoint configuration. besides the Jog & Shuttle, which has its
+ * own report type, the first key column comes right after the unit id and
+ * report type bytes, one row per bit
+ */
+static const struct xkeys_model jog_shuttle = {
+	.name = "Jog & Shuttle",
+	.product = 0x2b1,
+	.nkeys = 46,
+	.report_size = 13,
+	.type_offset = 1,
+	.type = 2,
+	.shuttle = 2,
+	.jog = 3,
+	.keys = 4,
+	.nkey_bytes = 9,
+	.key_bytes = {
+		{ 0x7f, 0 }, { 0x7f, 7 },
+		{ 0x0f, 14 }, { 0x0f, 18 }, { 0x0f, 22 }, { 0x0f, 26 },
+		{ 0x7f, 30 }, { 0x7f, 37 },
+		{ 0x03, 44 },
+	},
+};
+
+/* 4 columns of 6 keys */
+static const struct xkeys_model xk24 = {
+	.name = "XK-24",
+	.product = 0x405,
+	.nkeys = 24,
+	.report_size = 6,
+	.shuttle = -1,
+	.jog = -1,
+	.keys = 2,
+	.nkey_bytes = 4,
+	.key_bytes = {
+		{ 0x3f, 0 }, { 0x3f, 6 }, { 0x3f, 12 }, { 0x3f, 18 },
+	},
+};
+
+/* 10 columns of 8 keys. the XK-60 is the same board with larger keys */
+#define XK80_KEY_BYTES { \
+	{ 0xff, 0 }, { 0xff, 8 }, { 0xff, 16 }, { 0xff, 24 }, { 0xff, 32 }, \
+	{ 0xff, 40 }, { 0xff, 48 }, { 0xff, 56 }, { 0xff, 64 }, { 0xff, 72 }, \
+}
+
+static const struct xkeys_model xk60 = {
+	.name = "XK-60",
+	.product = 0x461,
+	.nkeys = 80,
+	.report_size = 12,
+	.shuttle = -1,
+	.jog = -1,
+	.keys = 2,
+	.nkey_bytes = 10,
+	.key_bytes = XK80_KEY_BYTES,
+};
+
+static const struct xkeys_model xk80 = {
+	.name = "XK-80",
+	.product = 0x441,
+	.nkeys = 80,
+	.report_size = 12,
+	.shuttle = -1,
+	.jog = -1,
+	.keys = 2,
+	.nkey_bytes = 10,
+	.key_bytes = XK80_KEY_BYTES,
+};
+
+/* 16 columns of 8 keys */
+static const struct xkeys_model xk128 = {
+	.name = "XK-128",
+	.product = 0x4cd,
+	.nkeys = 128,
+	.report_size = 18,
+	.shuttle = -1,
+	.jog = -1,
+	.keys = 2,
+	.nkey_bytes = 16,
+	.key_bytes = {
+		{ 0xff, 0 }, { 0xff, 8 }, { 0xff, 16 }, { 0xff, 24 },
+		{ 0xff, 32 }, { 0xff, 40 }, { 0xff, 48 }, { 0xff, 56 },
+		{ 0xff, 64 }, { 0xff, 72 }, { 0xff, 80 }, { 0xff, 88 },
+		{ 0xff, 96 }, { 0xff, 104 }, { 0xff, 112 }, { 0xff, 120 },
+	},
+};
+
+#define MODEL_DECODER(model) \
+static int decode_##model(struct device *dev, const unsigned char *report, \
+			  int size, uint64_t start) \
+{ \
+	return decode_report(dev, &model, report, size, start); \
+}
+
+MODEL_DECODER(jog_shuttle)
+MODEL_DECODER(xk24)
+MODEL_DECODER(xk60)
+MODEL_DECODER(xk80)
+MODEL_DECODER(xk128)
+
+static const struct {
+	const struct xkeys_model *model;
+	int (*decode)(struct device *dev, const unsigned char *report,
+		      int size, uint64_t start);
+} models[] = {
+	{ &jog_shuttle, decode_jog_shuttle },
+	{ &xk24, decode_xk24 },
+	{ &xk60, decode_xk60 },
+	{ &xk80, decode_xk80 },
+	{ &xk128, decode_xk128 },
+};
+#define NMODELS (sizeof(models) / sizeof(models[0]))
+
+const struct xkeys_model *xkeys_model_find(uint16_t product)
+{
+	int i;
+
+	for (i = 0; i < NMODELS; i++)
+		if (models[i].model->product == product)
+			return models[i].model;
+	return NULL;
+}
+
+/* returns 1 if the product isn't a known model */
+int device_set_model(struct device *dev, uint16_t product)
+{
+	int i;
+
+	for (i = 0; i < NMODELS; i++) {
+		if (models[i].model->product != product)
+			continue;
+		dev->model = models[i].model;
+		dev->decode = models[i].decode;
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * decoding of other HID devices, following the plan compiled from their
+ * report descriptor. the first relative control works as the jog dial,
+ * the second as the shuttle, both mapped the same way
+ */
+static int decode_hid(struct device *dev, const unsigned char *report,
+		      int size, uint64_t start)
+{
+	const struct hid_plan *plan = dev->plan;
+	const struct hid_segment *seg;
+	struct report_state *last = &dev->last;
+	uint64_t keys[XKEYS_KEY_WORDS] = { 0 };
+	int ret = 0, i, classes = 0;
+	int32_t value;
+
+	if (plan->report_id >= 0 && (size < 1 || report[0] != plan->report_id))
+		/* a report we don't use */
+		return 0;
+	if (size < plan->report_size) {
+		log_err("Short report from hidraw device (%i bytes)\n", size);
+		return 0;
+	}
+
+	for (i = 0; i < plan->nsegments; i++) {
+		seg = &plan->segments[i];
+		keys[seg->key / 64] |= hid_get_bits(report, seg->offset,
+						    seg->size) << (seg->key % 64);
+	}
+
+	if (!last->valid)
+		goto out;
+
+	for (i = 0; i < plan->ndials; i++) {
+		value = hid_get_signed(report, plan->dials[i].offset,
+				       plan->dials[i].size);
+		if (value == 0)
+			continue;
+		dev->out.dial[i] += value;
+		classes |= 1 << (i ? EVENT_CLASS_SHUTTLE : EVENT_CLASS_JOG);
+	}
+	ret = decode_keys(dev, keys, XKEYS_KEY_WORDS, &classes);
+
+out:
+	batch_classes(dev, classes, start);
+	for (i = 0; i < XKEYS_KEY_WORDS; i++)
+		last->keys[i] = keys[i];
+	last->valid = 1;
+	return ret;
+}
+
+/* the device takes ownership of the plan */
+void device_set_plan(struct device *dev, struct hid_plan *plan)
+{
+	free(dev->plan);
+	dev->model = NULL;
+	dev->plan = plan;
+	dev->decode = decode_hid;
+}
+
+/*
+ * a held block is released and pressed again, all of it or only its last
+ * key, so modifiers stay down. a sequence is run again, whole or from the
+ * start of its last block
+ */
+static int repeat_macro(struct device *dev, const struct macro *macro)
+{
+	const struct input_event *ev = macro->ev;
+	unsigned int n = macro->npress;
+
+	if (macro->nrelease == 0)
+		return run_steps(dev, macro, macro->repeat == REPEAT_LAST ?
+						macro->repeat_first : 0);
+	if (macro->repeat == REPEAT_SEQUENCE)
+		return queue_input_events(dev, ev + n, macro->nrelease) ||
+		       queue_input_events(dev, ev, n);
+	/* the press events are the keys followed by a SYN_REPORT */
+	return _write_input_event(dev, EV_KEY, ev[n - 2].code, 0) ||
+	       _write_input_event(dev, EV_SYN, SYN_REPORT, 1) ||
+	       _write_input_event(dev, EV_KEY, ev[n - 2].code, 1) ||
+	       _write_input_event(dev, EV_SYN, SYN_REPORT, 1);
+}
+
+static int repeat_expired(struct timer *timer)
+{
+	struct key_timer *t = container_of(timer, struct key_timer, timer);
+	struct device *dev = t->dev;
+	const struct macro *macro = key_macro(dev, t->key, 0);
+	int ret;
+
+	timer_add(timer, macro->repeat_interval);
+	ret = repeat_macro(dev, macro);
+	if (finish_batch(dev))
+		ret = 1;
+	return ret;
+}
+
+/* held long enough for the hold macro, or no double tap came */
+static int gesture_expired(struct timer *timer)
+{
+	struct key_timer *t = container_of(timer, struct key_timer, timer);
+	struct device *dev = t->dev;
+	struct macro *macro = key_macro(dev, t->key, 0);
+	int ret = 0;
+
+	if (t->state == GESTURE_DOWN) {
+		t->state = GESTURE_HELD;
+		ret = run_macro(&macro->gesture->hold, 1, dev);
+	} else if (t->state == GESTURE_UP) {
+		t->state = GESTURE_IDLE;
+		ret = tap_macro(dev, macro);
+	}
+	if (finish_batch(dev))
+		ret = 1;
+	return ret;
+}
+
+/* called by the macro scheduler once a delay is over */
+int device_macro_step(struct device *dev, const struct macro *macro,
+		      unsigned int next)
+{
+	int ret;
+
+	ret = run_steps(dev, macro, next);
+	if (finish_batch(dev))
+		ret = 1;
+	return ret;
+}
+
+/* decodes a single report and writes its events out */
+int device_report(struct device *dev, const unsigned char *report, int size,
+		  uint64_t start)
+{
+	int ret;
+
+	ret = dev->decode(dev, report, size, start);
+	if (finish_batch(dev))
+		ret = 1;
+	return ret;
+}
+
+static int evdev_events(struct device *dev, const struct input_event *ev,
+			int n);
+
+/* decodes what was read from the device: a report, or evdev events */
+static int decode_input(struct device *dev, const void *buf, int size,
+			uint64_t start)
+{
+	if (dev->evdev)
+		return evdev_events(dev, buf, size / sizeof(struct input_event));
+	record_report(dev, buf, size);
+	return dev->decode(dev, buf, size, start);
+}
+
+/*
+ * handles a single read done by an I/O backend. its events are only
+ * batched, device_flush() writes them out once the backend handled all
+ * the reads it got at once, so motion is summed up across them
+ */
+int device_process(struct device *dev, const void *buf, int size,
+		   uint64_t start)
+{
+	return decode_input(dev, buf, size, start);
+}
+
+int device_flush(struct device *dev)
+{
+	return finish_batch(dev);
+}
+
+/* how much is read from the device at once */
+int device_read_size(struct device *dev)
+{
+	if (dev->evdev)
+		return EVDEV_READ_EVENTS * sizeof(struct input_event);
+	return XKEYS_READ_SIZE;
+}
+
+/*
+ * the device is non blocking and everything it has queued is read at once,
+ * up to DEVICE_DRAIN_READS, with the events of all of it written together.
+ * reading more than one report per wakeup keeps the hidraw queue from
+ * overflowing while the jog is spun
+ */
+int device_input(struct device *dev)
+{
+	struct input_event buf[EVDEV_READ_EVENTS];
+	int size, i, ret = 0;
+
+	for (i = 0; i < DEVICE_DRAIN_READS && !ret; i++) {
+		size = read(dev->fd, buf, device_read_size(dev));
+		if (size < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			/* most likely unplugged, the other devices keep going */
+			log_err("Error reading from device \"%s\" (%s), detaching it\n",
+				dev->name, strerror(errno));
+			finish_batch(dev);
+			device_detach(dev);
+			return 0;
+		}
+		ret = decode_input(dev, buf, size, monotonic_ns());
+	}
+	if (finish_batch(dev))
+		ret = 1;
+	return ret;
+}
+
+/* the events gathered since the last SYN_REPORT are handled as a whole */
+static int evdev_frame(struct device *dev, uint64_t start)
+{
+	struct evdev_map *map = dev->evdev;
+	struct report_state *last = &dev->last;
+	int ret, i, classes = 0;
+
+	for (i = 0; i < 2; i++) {
+		if (map->dial[i] == 0)
+			continue;
+		dev->out.dial[i] += map->dial[i];
+		map->dial[i] = 0;
+		classes |= 1 << (i ? EVENT_CLASS_SHUTTLE : EVENT_CLASS_JOG);
+	}
+	ret = decode_keys(dev, map->keys, XKEYS_KEY_WORDS, &classes);
+	batch_classes(dev, classes, start);
+	for (i = 0; i < XKEYS_KEY_WORDS; i++)
+		last->keys[i] = map->keys[i];
+	return ret;
+}
+
+/*
+ * as many events as there are queued, up to EVDEV_READ_EVENTS, are read
+ * at once. latency is measured from the kernel's timestamp of the
+ * SYN_REPORT, which is when the device's report was decoded
+ */
+static int evdev_events(struct device *dev, const struct input_event *ev,
+			int n)
+{
+	struct evdev_map *map = dev->evdev;
+	unsigned char idx;
+	uint64_t start;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		/* after SYN_DROPPED, up to the next SYN_REPORT is garbage */
+		if (map->dropped &&
+		    (ev[i].type != EV_SYN || ev[i].code != SYN_REPORT))
+			continue;
+		switch (ev[i].type) {
+		case EV_KEY:
+			/* autorepeat is left to the applications */
+			if (ev[i].code >= KEY_CNT || ev[i].value == 2)
+				break;
+			idx = map->key[ev[i].code];
+			if (idx == EVDEV_NONE)
+				break;
+			if (ev[i].value)
+				map->keys[idx / 64] |= 1ULL << (idx % 64);
+			else
+				map->keys[idx / 64] &= ~(1ULL << (idx % 64));
+			break;
+		case EV_REL:
+			if (ev[i].code < REL_CNT &&
+			    (idx = map->rel[ev[i].code]) != EVDEV_NONE)
+				map->dial[idx] += ev[i].value;
+			break;
+		case EV_ABS:
+			if (ev[i].code >= ABS_CNT ||
+			    (idx = map->abs[ev[i].code]) == EVDEV_NONE)
+				break;
+			if (map->abs_valid[idx])
+				map->dial[idx] += ev[i].value - map->abs_last[idx];
+			map->abs_last[idx] = ev[i].value;
+			map->abs_valid[idx] = 1;
+			break;
+		case EV_SYN:
+			if (ev[i].code == SYN_DROPPED) {
+				/*
+				 * the frame so far is dropped too, and absolute
+				 * dials start over from their next position
+				 * instead of jumping over the lost motion
+				 */
+				map->dropped = 1;
+				map->dial[0] = map->dial[1] = 0;
+				map->abs_valid[0] = map->abs_valid[1] = 0;
+				break;
+			}
+			if (ev[i].code != SYN_REPORT)
+				break;
+			if (map->dropped) {
+				/* take the keys as they are now */
+				evdev_sync_keys(dev->fd, map);
+				map->dropped = 0;
+			}
+			start = ev[i].input_event_sec * 1000000000ULL +
+				ev[i].input_event_usec * 1000ULL;
+			if (evdev_frame(dev, start))
+				return 1;
+			break;
+		}
+	}
+	return 0;
+}
+
+/* the device takes ownership of the map, its key state is the current one */
+void device_set_evdev(struct device *dev, struct evdev_map *map)
+{
+	int i;
+
+	free(dev->evdev);
+	dev->model = NULL;
+	dev->evdev = map;
+	for (i = 0; i < XKEYS_KEY_WORDS; i++)
+		dev->last.keys[i] = map->keys[i];
+	dev->last.valid = 1;
+}
+
+/*
+ * a device detached by a hotplug remove may still have an event in the
+ * batch epoll_wait() returned, it has nothing left to read or report
+ */
+static int device_source_input(struct loop_source *source)
+{
+	struct device *dev = container_of(source, struct device, source);
+
+	if (dev->fd < 0)
+		return 0;
+	return device_input(dev);
+}
+
+/*
+ * starts waiting for reports from the device, in the main loop or with
+ * reads kept posted in the io_uring
+ */
+int device_attach(struct device *dev)
+{
+	int flags;
+
+	/* reads are drained until EAGAIN, with read() as with io_uring */
+	flags = fcntl(dev->fd, F_GETFL);
+	if (flags < 0 || fcntl(dev->fd, F_SETFL, flags | O_NONBLOCK)) {
+		log_err("Error setting up device \"%s\" (%s)\n", dev->name,
+			strerror(errno));
+		return 1;
+	}
+	if (uring_enabled())
+		return uring_attach(dev);
+	dev->source.handler = device_source_input;
+	return loop_add(dev->fd, &dev->source);
+}
+
+/*
+ * sends the release part of the macros of every key still held, so nothing
+ * stays pressed when the mapping or the uinput device goes away. ring
+ * readers get the releases as well. the keys are marked stale, so their
+ * physical release doesn't send anything
+ */
+void device_release_keys(struct device *dev)
+{
+	uint64_t held;
+	int i, w;
+
+	if (!dev->last.valid) {
+		key_timers_stop(dev);
+		return;
+	}
+	for (w = 0; w < XKEYS_KEY_WORDS; w++) {
+		held = dev->last.keys[w] & ~dev->last.stale[w];
+		for_each_changed_key(i, held) {
+			if (dev->ring)
+				ring_publish(dev->ring, RING_EVENT_KEY, w * 64 + i, 0);
+			if (dev->uinput >= 0)
+				release_key(dev, w * 64 + i);
+		}
+		dev->last.stale[w] = dev->last.keys[w];
+	}
+	key_timers_stop(dev);
+	/* a layer held by a key goes away with it */
+	dev->layer = dev->base_layer;
+	dev->active = mapping_layer(dev->mapping, dev->layer);
+	if (dev->uinput >= 0)
+		flush_input_events(dev);
+}
+
+void device_uinput_destroy(struct device *dev)
+{
+	if (dev->uinput < 0)
+		return;
+	macro_cancel(dev);
+	device_release_keys(dev);
+	ioctl(dev->uinput, UI_DEV_DESTROY);
+	close(dev->uinput);
+	dev->uinput = -1;
+	dev->out.count = 0;
+}
+
+/* switches to a layer as a key with a "switch" action does */
+int device_set_layer(struct device *dev, unsigned int layer)
+{
+	if (dev->mapping == NULL || layer > dev->mapping->nlayers)
+		return 1;
+	dev->base_layer = dev->layer = layer;
+	dev->active = mapping_layer(dev->mapping, layer);
+	return 0;
+}
+
+/*
+ * runs a key as if a report had changed it, for testing. the next report
+ * read from the device tells the actual state of the key again
+ */
+int device_inject_key(struct device *dev, unsigned int key, int value)
+{
+	uint64_t keys[XKEYS_KEY_WORDS];
+	int ret, classes = 0;
+
+	if (key >= XKEYS_MAX_KEYS || dev->mapping == NULL ||
+	    (dev->uinput < 0 && dev->ring == NULL))
+		return 1;
+	memcpy(keys, dev->last.keys, sizeof(keys));
+	if (value)
+		keys[key / 64] |= 1ULL << (key % 64);
+	else
+		keys[key / 64] &= ~(1ULL << (key % 64));
+	ret = decode_keys(dev, keys, XKEYS_KEY_WORDS, &classes);
+	memcpy(dev->last.keys, keys, sizeof(keys));
+	batch_classes(dev, classes, monotonic_ns());
+	if (finish_batch(dev))
+		ret = 1;
+	return ret;
+}
+
+/* same for motion of a dial: 0 is the jog wheel, 1 the shuttle */
+int device_inject_dial(struct device *dev, unsigned int axle, int32_t value)
+{
+	if (axle > 1 || dev->mapping == NULL ||
+	    (dev->uinput < 0 && dev->ring == NULL))
+		return 1;
+	dev->out.dial[axle] += value;
+	batch_classes(dev, 1 << (axle ? EVENT_CLASS_SHUTTLE : EVENT_CLASS_JOG),
+		      monotonic_ns());
+	return finish_batch(dev);
+}
+
+/*
+ * switches the device to a new mapping, returning the old one. held keys
+ * are released with the mapping that pressed them first, and the device
+ * starts over in the base layer
+ */
+struct mapping *device_set_mapping(struct device *dev, struct mapping *mapping)
+{
+	struct mapping *old = dev->mapping;
+
+	/* the sequences running refer to the old mapping */
+	macro_cancel(dev);
+	device_release_keys(dev);
+	dev->mapping = mapping;
+	dev->active = mapping;
+	dev->layer = dev->base_layer = 0;
+	return old;
+}
+
+/*
+ * stops using the device: keys still held are released and the uinput
+ * device goes away with it
+ */
+void device_detach(struct device *dev)
+{
+	if (dev->fd < 0)
+		return;
+
+	if (dev->uring)
+		uring_detach(dev);
+	else
+		loop_del(dev->fd);
+	close(dev->fd);
+	dev->fd = -1;
+
+	/* without uinput, the keys are still released for the ring */
+	if (dev->uinput < 0)
+		device_release_keys(dev);
+	device_uinput_destroy(dev);
+	dev->out.count = 0;
+	dev->out.dial[0] = dev->out.dial[1] = 0;
+	dev->out.classes = 0;
+	memset(&dev->last, 0, sizeof(dev->last));
+	free(dev->plan);
+	dev->plan = NULL;
+	free(dev->evdev);
+	dev->evdev = NULL;
+	key_timers_stop(dev);
+	free(dev->key_timers);
+	dev->key_timers = NULL;
+}
+
+static const char *event_class_names[EVENT_CLASSES] = {
+	[EVENT_CLASS_KEY] = "key",
+	[EVENT_CLASS_JOG] = "jog",
+	[EVENT_CLASS_SHUTTLE] = "shuttle",
+};
+
+void device_print_stats(struct device *dev, FILE *f)
+{
+	struct histogram *h;
+	int i;
+
+	fprintf(f, "device \"%s\": %lu events in %lu uinput writes\n",
+		dev->name, dev->out.events, dev->out.flushes);
+	if (dev->out.skipped_delays)
+		fprintf(f, "  %lu macro delays skipped, too many macros running\n",
+			dev->out.skipped_delays);
+	for (i = 0; i < EVENT_CLASSES; i++) {
+		h = &dev->latency[i];
+		if (h->samples == 0)
+			continue;
+		fprintf(f, "  %s latency: %llu samples, p50 %lluns p99 %lluns p999 %lluns max %lluns\n",
+			event_class_names[i], (unsigned long long)h->samples,
+			(unsigned long long)histogram_percentile(h, 500),
+			(unsigned long long)histogram_percentile(h, 990),
+			(unsigned long long)histogram_percentile(h, 999),
+			(unsigned long long)h->max);
+	}
+}
+
+/* to the log, a line at a time */
+void device_dump_stats(struct device *dev)
+{
+	char *buf, *line, *save;
+	size_t size;
+	FILE *f;
+
+	f = open_memstream(&buf, &size);
+	if (f == NULL)
+		return;
+	device_print_stats(dev, f);
+	fclose(f);
+	for (line = strtok_r(buf, "\n", &save); line;
+	     line = strtok_r(NULL, "\n", &save))
+		log("%s\n", line);
+	free(buf);
+}
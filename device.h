@@ -0,0 +1,258 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef DEVICE_H
+#define DEVICE_H
+#include <stdio.h>
+#include <stdint.h>
+#include <linux/input.h>
+
+#include "input.h"
+#include "xkeys.h"
+#include "loop.h"
+#include "histogram.h"
+#include "hiddesc.h"
+#include "evdev.h"
+#include "timer.h"
+#include "ring.h"
+
+#define MAX_PRESSED_KEYS	10
+
+/*
+ * a macro is compiled at config load time into the exact sequence of
+ * events it generates, so running it is just a copy to the output batch.
+ * 'ev' holds the events sent on key press followed by the ones sent on
+ * key release
+ */
+struct macro {
+	struct input_event *ev;
+	unsigned int npress;
+	unsigned int nrelease;
+	/* auto-repeat while the key is held */
+	uint8_t repeat;			/* REPEAT_* */
+	uint16_t repeat_first;		/* first event of the last block */
+	uint16_t repeat_delay;		/* ms before the first repeat */
+	uint16_t repeat_interval;	/* ms between repeats */
+	struct gesture *gesture;	/* NULL for a plain key */
+	/* layer switch done by the key, besides its events */
+	uint8_t layer_mode;		/* LAYER_* */
+	uint8_t layer;
+};
+
+/*
+ * a key can do something else when held past hold_time, or pressed again
+ * within double_time of its release. the key's own macro is the tap. a
+ * macro without events means the gesture isn't used
+ */
+struct gesture {
+	struct macro hold;
+	struct macro dtap;
+	uint16_t hold_time;
+	uint16_t double_time;
+};
+#define GESTURE_HOLD_TIME	400
+#define GESTURE_DOUBLE_TIME	250
+
+enum repeat_mode {
+	REPEAT_NONE,
+	REPEAT_SEQUENCE,	/* the whole macro again */
+	REPEAT_LAST,		/* only its last block, or last key if held */
+};
+#define REPEAT_DELAY		500
+#define REPEAT_RATE		25
+
+/*
+ * a delay between the steps of a sequence is kept in the events as an
+ * EV_SYN with this code, which the kernel doesn't use, and the delay in ms
+ * as value. it's never written to uinput
+ */
+#define MACRO_DELAY		SYN_MAX
+#define MACRO_MAX_DELAY		60000
+
+enum layer_mode {
+	LAYER_NONE,
+	LAYER_SWITCH,		/* to the layer, until another switch */
+	LAYER_TOGGLE,		/* to the layer, or back to the base one */
+	LAYER_HOLD,		/* to the layer while the key is held */
+};
+#define MAX_LAYERS		16
+#define LAYER_NAME_SIZE		32
+
+/*
+ * everything a device takes from the configuration file. devices only hold
+ * a pointer to it, so a reloaded configuration is switched in at once.
+ * every layer is a mapping of its own, the base one (layer 0) has the
+ * others, so switching layers is just picking another table
+ */
+struct mapping {
+	struct macro keys[XKEYS_MAX_KEYS];
+	uint16_t axles[2];
+	char name[LAYER_NAME_SIZE];		/* "base" for layer 0 */
+	struct mapping *layers[MAX_LAYERS - 1];	/* layer N is layers[N - 1] */
+	unsigned int nlayers;
+};
+
+static inline struct mapping *mapping_layer(struct mapping *mapping,
+					    unsigned int layer)
+{
+	return layer ? mapping->layers[layer - 1] : mapping;
+}
+
+/*
+ * snapshot of the previous report of a device. it's small enough to fit
+ * in a single cache line, so keep it aligned to one so it never spans two.
+ * this makes struct device 64 byte aligned too, heap copies need
+ * aligned_alloc()
+ */
+struct report_state {
+	uint64_t keys[XKEYS_KEY_WORDS];	/* key N on bit N % 64 of word N / 64 */
+	/* held while the mapping changed, already released with the old one */
+	uint64_t stale[XKEYS_KEY_WORDS];
+	unsigned char shuttle;
+	unsigned char jog;
+	unsigned char valid;
+} __attribute__((aligned(64)));
+
+/*
+ * events generated while decoding the reports read in one go are queued
+ * here and handed to uinput with a single write() once they're all done.
+ * jog and shuttle motion is summed up until a key changes or the batch
+ * ends, so a fast spin turns into a single event per axle
+ */
+#define OUTPUT_BATCH_SIZE	64
+/* reads done per wakeup, so a busy device doesn't starve the others */
+#define DEVICE_DRAIN_READS	64
+struct device;
+struct output_batch {
+	struct input_event ev[OUTPUT_BATCH_SIZE];
+	int count;
+	int32_t dial[2];	/* motion not queued yet, per axle */
+	int classes;		/* event classes in the batch */
+	uint64_t start;		/* when the first of them was read */
+	/* set by an I/O backend that writes the events itself */
+	int (*write)(struct device *dev, const struct input_event *ev,
+		     unsigned int count);
+	/* and then takes the latency of a batch once its write completed */
+	void (*account)(struct device *dev, int classes, uint64_t start);
+	/* statistics: number of flushes and events written */
+	unsigned long flushes;
+	unsigned long events;
+	/* delays skipped because every macro run was in use */
+	unsigned long skipped_delays;
+};
+
+/* latency is accounted separately for each kind of event */
+enum event_class {
+	EVENT_CLASS_KEY,
+	EVENT_CLASS_JOG,
+	EVENT_CLASS_SHUTTLE,
+	EVENT_CLASSES,
+};
+
+/* where a key with gestures is while they're told apart */
+enum gesture_state {
+	GESTURE_IDLE,
+	GESTURE_DOWN,		/* pressed, could still be held */
+	GESTURE_HELD,		/* the hold macro is pressed */
+	GESTURE_UP,		/* tapped once, could still be a double tap */
+	GESTURE_DOUBLE,		/* the double tap macro is pressed */
+};
+
+/* per key timer, for auto-repeat or gestures, run in the timer wheel */
+struct key_timer {
+	struct timer timer;
+	struct device *dev;
+	unsigned int key;
+	enum gesture_state state;
+};
+
+/* where the events of a device are read from */
+enum input_method {
+	METHOD_HIDRAW,		/* raw reports, decoded by xkeysd */
+	METHOD_EVDEV,		/* events already decoded by the kernel */
+};
+
+/* where the events of a device go, one or both */
+enum device_sink {
+	SINK_UINPUT = 1 << 0,	/* the macros, to the uinput device */
+	SINK_RING = 1 << 1,	/* the decoded keys and dials, to the ring */
+};
+#define RING_NAME_SIZE		64
+
+struct device {
+	unsigned int id;	/* position in the configuration file */
+	int fd;
+	int hidraw;		/* hidraw node number, -1 if unknown */
+	int event;		/* eventN node number, -1 if unknown */
+	enum input_method method;
+	int uinput;
+	char filename[128];
+	char name[64];
+	uint16_t vendor;
+	uint16_t product;
+	char serial[64];
+	unsigned int sinks;		/* SINK_* */
+	char ring_name[RING_NAME_SIZE];	/* shm_open() name of the ring */
+	uint32_t ring_size;		/* events, a power of two */
+	struct ring *ring;		/* NULL until opened */
+	const struct xkeys_model *model;	/* NULL for other HID devices */
+	struct hid_plan *plan;		/* only for other HID devices */
+	struct evdev_map *evdev;	/* only for the evdev method */
+	/* decode routine specialized for the model */
+	int (*decode)(struct device *dev, const unsigned char *report,
+		      int size, uint64_t start);
+	struct mapping *mapping;	/* NULL if not in use */
+	struct mapping *active;		/* the table of the layer in use */
+	uint8_t layer;			/* the layer in use */
+	uint8_t base_layer;		/* where a held layer goes back to */
+	uint8_t key_layer[XKEYS_MAX_KEYS];	/* where held keys were pressed */
+	struct report_state last;
+	struct output_batch out;
+	struct loop_source source;
+	struct uring_slot *uring;	/* only with the io_uring backend */
+	struct key_timer *key_timers;	/* per key, once one needed it */
+	/* from the report being read to its events written to uinput, in ns */
+	struct histogram latency[EVENT_CLASSES];
+};
+
+int compile_macro(struct input_translate *priv, char *value, struct macro *macro);
+int device_set_model(struct device *dev, uint16_t product);
+void device_set_plan(struct device *dev, struct hid_plan *plan);
+void device_set_evdev(struct device *dev, struct evdev_map *map);
+void mapping_free(struct mapping *mapping);
+int flush_input_events(struct device *dev);
+int device_report(struct device *dev, const unsigned char *report, int size,
+		  uint64_t start);
+int device_process(struct device *dev, const void *buf, int size,
+		   uint64_t start);
+int device_flush(struct device *dev);
+void device_account(struct device *dev, int classes, uint64_t start);
+int device_read_size(struct device *dev);
+int device_input(struct device *dev);
+int device_macro_step(struct device *dev, const struct macro *macro,
+		      unsigned int next);
+int device_attach(struct device *dev);
+void device_detach(struct device *dev);
+void device_release_keys(struct device *dev);
+void device_uinput_destroy(struct device *dev);
+struct mapping *device_set_mapping(struct device *dev, struct mapping *mapping);
+int device_set_layer(struct device *dev, unsigned int layer);
+int device_inject_key(struct device *dev, unsigned int key, int value);
+int device_inject_dial(struct device *dev, unsigned int axle, int32_t value);
+void device_print_stats(struct device *dev, FILE *f);
+void device_dump_stats(struct device *dev);
+#endif	/* DEVICE_H */
@@ -0,0 +1,97 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "log.h"
+#include "evdev.h"
+
+#define BITS_PER_LONG		(sizeof(unsigned long) * 8)
+#define NLONGS(x)		(((x) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define test_bit(bit, array)	((array[(bit) / BITS_PER_LONG] >> ((bit) % BITS_PER_LONG)) & 1)
+
+/* builds the code to key and dial tables from what the device supports */
+int evdev_map_init(int fd, struct evdev_map *map)
+{
+	unsigned long keybits[NLONGS(KEY_CNT)], relbits[NLONGS(REL_CNT)];
+	unsigned long absbits[NLONGS(ABS_CNT)];
+	struct input_absinfo absinfo;
+	int code, clock = CLOCK_MONOTONIC;
+
+	memset(map, 0, sizeof(*map));
+	memset(map->key, EVDEV_NONE, sizeof(map->key));
+	memset(map->rel, EVDEV_NONE, sizeof(map->rel));
+	memset(map->abs, EVDEV_NONE, sizeof(map->abs));
+	memset(keybits, 0, sizeof(keybits));
+	memset(relbits, 0, sizeof(relbits));
+	memset(absbits, 0, sizeof(absbits));
+
+	if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keybits)), keybits) < 0 ||
+	    ioctl(fd, EVIOCGBIT(EV_REL, sizeof(relbits)), relbits) < 0 ||
+	    ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(absbits)), absbits) < 0) {
+		log_err("Unable to get the events supported by the event device (%s)\n",
+			strerror(errno));
+		return 1;
+	}
+
+	for (code = 0; code < KEY_CNT && map->nkeys < XKEYS_MAX_KEYS; code++)
+		if (test_bit(code, keybits))
+			map->key[code] = map->nkeys++;
+	for (code = 0; code < REL_CNT && map->ndials < 2; code++)
+		if (test_bit(code, relbits))
+			map->rel[code] = map->ndials++;
+	for (code = 0; code < ABS_CNT && map->ndials < 2; code++) {
+		if (!test_bit(code, absbits))
+			continue;
+		if (ioctl(fd, EVIOCGABS(code), &absinfo) == 0) {
+			map->abs_last[map->ndials] = absinfo.value;
+			map->abs_valid[map->ndials] = 1;
+		}
+		map->abs[code] = map->ndials++;
+	}
+
+	/* event timestamps are compared with monotonic_ns() */
+	if (ioctl(fd, EVIOCSCLOCKID, &clock))
+		log_err("Unable to use monotonic timestamps on the event device (%s)\n",
+			strerror(errno));
+
+	return evdev_sync_keys(fd, map);
+}
+
+/* reads the state of every key, at start and after events were lost */
+int evdev_sync_keys(int fd, struct evdev_map *map)
+{
+	unsigned long state[NLONGS(KEY_CNT)];
+	int code, key;
+
+	memset(state, 0, sizeof(state));
+	if (ioctl(fd, EVIOCGKEY(sizeof(state)), state) < 0) {
+		log_err("Unable to get the key state of the event device (%s)\n",
+			strerror(errno));
+		return 1;
+	}
+	memset(map->keys, 0, sizeof(map->keys));
+	for (code = 0; code < KEY_CNT; code++) {
+		key = map->key[code];
+		if (key != EVDEV_NONE && test_bit(code, state))
+			map->keys[key / 64] |= 1ULL << (key % 64);
+	}
+	return 0;
+}
@@ -0,0 +1,52 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef EVDEV_H
+#define EVDEV_H
+#include <stdint.h>
+#include <linux/input.h>
+
+#include "xkeys.h"
+
+/*
+ * the evdev method reads the events the kernel already decoded from the
+ * device's event node. keys are numbered in the order of their codes, so
+ * on a device with BTN_0 to BTN_9 key0 is BTN_0. the first two relative
+ * or absolute axes are the dials. events are gathered until SYN_REPORT
+ * and then handled as a whole, like a hidraw report
+ */
+#define EVDEV_NONE		0xff
+/* events read at once */
+#define EVDEV_READ_EVENTS	64
+
+struct evdev_map {
+	unsigned char key[KEY_CNT];	/* code -> key, or EVDEV_NONE */
+	unsigned char rel[REL_CNT];	/* code -> dial, or EVDEV_NONE */
+	unsigned char abs[ABS_CNT];
+	unsigned int nkeys;
+	unsigned int ndials;
+	/* the frame being gathered */
+	uint64_t keys[XKEYS_KEY_WORDS];
+	int32_t dial[2];
+	int32_t abs_last[2];	/* absolute dials send differences */
+	unsigned char abs_valid[2];
+	unsigned char dropped;	/* events were lost, skip to SYN_REPORT */
+};
+
+int evdev_map_init(int fd, struct evdev_map *map);
+int evdev_sync_keys(int fd, struct evdev_map *map);
+#endif	/* EVDEV_H */
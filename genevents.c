@@ -0,0 +1,233 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+/*
+ * build time generator for input_events.h: takes the event names listed in
+ * input_events.list (extracted from <linux/input.h> by the Makefile), lets
+ * the compiler resolve their values and writes out a collision free hash
+ * table of names plus the code to name tables used by input.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/input.h>
+
+#include "input_hash.h"
+
+#define EVENT(x) { #x, x },
+static const struct {
+	const char *name;
+	int value;
+} list[] = {
+#include "input_events.list"
+};
+#define LIST_SIZE (sizeof(list) / sizeof(list[0]))
+
+static const struct {
+	const char *prefix;
+	uint16_t type;
+	const char *table;
+	const char *count;
+} prefixes[] = {
+	{ "KEY_", EV_KEY, "key", "KEY_CNT" },
+	{ "BTN_", EV_KEY, "key", "KEY_CNT" },
+	{ "SYN_", EV_SYN, "syn", "SYN_CNT" },
+	{ "REL_", EV_REL, "rel", "REL_CNT" },
+	{ "ABS_", EV_ABS, "abs", "ABS_CNT" },
+	{ "MSC_", EV_MSC, "msc", "MSC_CNT" },
+	{ "SW_", EV_SW, "sw", "SW_CNT" },
+	{ "LED_", EV_LED, "led", "LED_CNT" },
+	{ "SND_", EV_SND, "snd", "SND_CNT" },
+	{ "REP_", EV_REP, "rep", "REP_CNT" },
+	{ "FF_", EV_FF, "ff", "FF_CNT" },
+};
+#define NPREFIXES (sizeof(prefixes) / sizeof(prefixes[0]))
+
+#define MAX_DISP 65535
+
+static struct input_event_name names[LIST_SIZE];
+static int nnames;
+
+static int *slot_of;		/* name index -> slot */
+static int *bucket_of;		/* name index -> bucket */
+
+static int find_prefix(const char *name)
+{
+	int i;
+
+	for (i = 0; i < NPREFIXES; i++)
+		if (!strncmp(name, prefixes[i].prefix, strlen(prefixes[i].prefix)))
+			return i;
+	return -1;
+}
+
+static int bucket_size(int bucket)
+{
+	int i, n = 0;
+
+	for (i = 0; i < nnames; i++)
+		if (bucket_of[i] == bucket)
+			n++;
+	return n;
+}
+
+static int place_bucket(int bucket, int *used)
+{
+	uint32_t d;
+	int i, j, ok;
+
+	for (d = 1; d <= MAX_DISP; d++) {
+		ok = 1;
+		for (i = 0; i < nnames && ok; i++) {
+			if (bucket_of[i] != bucket)
+				continue;
+			slot_of[i] = input_event_hash(names[i].name, d) % nnames;
+			if (used[slot_of[i]])
+				ok = 0;
+			for (j = 0; j < i && ok; j++)
+				if (bucket_of[j] == bucket && slot_of[j] == slot_of[i])
+					ok = 0;
+		}
+		if (!ok)
+			continue;
+		for (i = 0; i < nnames; i++)
+			if (bucket_of[i] == bucket)
+				used[slot_of[i]] = 1;
+		return d;
+	}
+	return -1;
+}
+
+static void write_code_tables(void)
+{
+	int p, q, i, j, seen;
+
+	for (p = 0; p < NPREFIXES; p++) {
+		/* prefixes sharing a table (KEY_/BTN_) are written once */
+		for (q = 0; q < p; q++)
+			if (!strcmp(prefixes[q].table, prefixes[p].table))
+				break;
+		if (q != p)
+			continue;
+
+		printf("static const char *input_%s_names[%s] = {\n",
+		       prefixes[p].table, prefixes[p].count);
+		for (i = 0; i < nnames; i++) {
+			if (names[i].type != prefixes[p].type)
+				continue;
+			/* first name defined for a code wins over aliases */
+			for (j = 0, seen = 0; j < i && !seen; j++)
+				seen = names[j].type == names[i].type &&
+				       names[j].code == names[i].code;
+			if (!seen)
+				printf("\t[%u] = \"%s\",\n", names[i].code,
+				       names[i].name);
+		}
+		printf("};\n\n");
+	}
+
+	printf("static const struct {\n\tint max;\n\tconst char **names;\n} input_code_names[EV_CNT] = {\n");
+	for (p = 0; p < NPREFIXES; p++) {
+		for (q = 0; q < p; q++)
+			if (!strcmp(prefixes[q].table, prefixes[p].table))
+				break;
+		if (q != p)
+			continue;
+		printf("\t[%u] = { %s, input_%s_names },\n", prefixes[p].type,
+		       prefixes[p].count, prefixes[p].table);
+	}
+	printf("};\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int i, j, p, b, nbuckets, *disp, *used, *order, *sizes, tmp;
+
+	for (i = 0; i < LIST_SIZE; i++) {
+		p = find_prefix(list[i].name);
+		if (p < 0)
+			continue;
+		for (j = 0; j < nnames; j++)
+			if (!strcmp(names[j].name, list[i].name))
+				break;
+		if (j != nnames)
+			continue;
+		names[nnames].name = list[i].name;
+		names[nnames].type = prefixes[p].type;
+		names[nnames].code = list[i].value;
+		nnames++;
+	}
+
+	nbuckets = (nnames + 3) / 4;
+	slot_of = calloc(nnames, sizeof(int));
+	bucket_of = calloc(nnames, sizeof(int));
+	used = calloc(nnames, sizeof(int));
+	disp = calloc(nbuckets, sizeof(int));
+	order = calloc(nbuckets, sizeof(int));
+	sizes = calloc(nbuckets, sizeof(int));
+	if (!slot_of || !bucket_of || !used || !disp || !order || !sizes) {
+		fprintf(stderr, "Not enough memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < nnames; i++)
+		bucket_of[i] = input_event_hash(names[i].name, 0) % nbuckets;
+
+	/* place the biggest buckets first, while there's room to spare */
+	for (b = 0; b < nbuckets; b++) {
+		order[b] = b;
+		sizes[b] = bucket_size(b);
+	}
+	for (i = 1; i < nbuckets; i++)
+		for (j = i; j > 0 && sizes[order[j]] > sizes[order[j - 1]]; j--) {
+			tmp = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = tmp;
+		}
+
+	for (b = 0; b < nbuckets; b++) {
+		if (sizes[order[b]] == 0)
+			break;
+		disp[order[b]] = place_bucket(order[b], used);
+		if (disp[order[b]] < 0) {
+			fprintf(stderr, "Unable to find a perfect hash for the event names\n");
+			return 1;
+		}
+	}
+
+	printf("/* generated by genevents from <linux/input.h>, do not edit */\n");
+	printf("#define INPUT_EVENT_NAMES %i\n", nnames);
+	printf("#define INPUT_EVENT_BUCKETS %i\n\n", nbuckets);
+
+	printf("static const struct input_event_name input_event_names[INPUT_EVENT_NAMES] = {\n");
+	for (i = 0; i < nnames; i++)
+		for (j = 0; j < nnames; j++)
+			if (slot_of[j] == i)
+				printf("\t{ \"%s\", %u, %u },\n", names[j].name,
+				       names[j].type, names[j].code);
+	printf("};\n\n");
+
+	printf("static const uint16_t input_event_disp[INPUT_EVENT_BUCKETS] = {");
+	for (b = 0; b < nbuckets; b++)
+		printf("%s%i,", (b % 12) ? " " : "\n\t", disp[b]);
+	printf("\n};\n\n");
+
+	write_code_tables();
+
+	return 0;
+}
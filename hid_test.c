@@ -0,0 +1,93 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+/* compiles the plan of a few HID report descriptors and checks it */
+#include <stdio.h>
+#include <string.h>
+
+#include "hiddesc.h"
+
+int run_as_daemon;
+
+/* boot protocol mouse with a wheel: 3 buttons, 5 bits padding, X, Y, wheel */
+static const unsigned char mouse[] = {
+	0x05, 0x01, 0x09, 0x02, 0xa1, 0x01, 0x09, 0x01, 0xa1, 0x00,
+	0x05, 0x09, 0x19, 0x01, 0x29, 0x03, 0x15, 0x00, 0x25, 0x01,
+	0x95, 0x03, 0x75, 0x01, 0x81, 0x02,
+	0x95, 0x01, 0x75, 0x05, 0x81, 0x03,
+	0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x09, 0x38, 0x15, 0x81,
+	0x25, 0x7f, 0x75, 0x08, 0x95, 0x03, 0x81, 0x06,
+	0xc0, 0xc0,
+};
+
+/* foot pedal: report 1 is a keyboard, report 2 has the 3 pedals as buttons */
+static const unsigned char pedal[] = {
+	0x05, 0x01, 0x09, 0x06, 0xa1, 0x01, 0x85, 0x01,
+	0x05, 0x07, 0x19, 0x00, 0x29, 0xff, 0x15, 0x00, 0x26, 0xff, 0x00,
+	0x75, 0x08, 0x95, 0x06, 0x81, 0x00, 0xc0,
+	0x05, 0x0c, 0x09, 0x01, 0xa1, 0x01, 0x85, 0x02,
+	0x05, 0x09, 0x19, 0x01, 0x29, 0x03, 0x15, 0x00, 0x25, 0x01,
+	0x75, 0x01, 0x95, 0x03, 0x81, 0x02,
+	0x75, 0x05, 0x95, 0x01, 0x81, 0x01, 0xc0,
+};
+
+/* the mouse buttons followed by padding with a report count of 2^32 - 1 */
+static const unsigned char huge[] = {
+	0x05, 0x01, 0x09, 0x02, 0xa1, 0x01,
+	0x05, 0x09, 0x19, 0x01, 0x29, 0x03, 0x15, 0x00, 0x25, 0x01,
+	0x95, 0x03, 0x75, 0x01, 0x81, 0x02,
+	0x97, 0xff, 0xff, 0xff, 0xff, 0x75, 0x08, 0x81, 0x03,
+	0xc0,
+};
+
+int main(int argc, char *argv[])
+{
+	const unsigned char report[] = { 0x05, 0xfe, 0x03, 0xff };
+	struct hid_plan plan;
+
+	if (hid_plan_compile(mouse, sizeof(mouse), &plan))
+		return 1;
+	if (plan.report_id != -1 || plan.report_size != 4 || plan.nkeys != 3 ||
+	    plan.nsegments != 1 || plan.segments[0].offset != 0 ||
+	    plan.segments[0].size != 3 || plan.ndials != 2 ||
+	    plan.dials[0].offset != 8 || plan.dials[1].offset != 16) {
+		printf("wrong plan for the mouse\n");
+		return 1;
+	}
+	if (hid_get_bits(report, 0, 3) != 5 ||
+	    hid_get_signed(report, 8, 8) != -2 ||
+	    hid_get_bits(report, 12, 8) != 0x3f) {
+		printf("wrong fields extracted from the mouse report\n");
+		return 1;
+	}
+
+	if (hid_plan_compile(pedal, sizeof(pedal), &plan))
+		return 1;
+	if (plan.report_id != 2 || plan.report_size != 2 || plan.nkeys != 3 ||
+	    plan.segments[0].offset != 8 || plan.ndials != 0) {
+		printf("wrong plan for the pedal\n");
+		return 1;
+	}
+
+	if (!hid_plan_compile(huge, sizeof(huge), &plan)) {
+		printf("report bigger than the kernel allows accepted\n");
+		return 1;
+	}
+
+	printf("HID report descriptors ok\n");
+	return 0;
+}
@@ -0,0 +1,287 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <string.h>
+
+#include "log.h"
+#include "hiddesc.h"
+
+/* item types and tags, from the HID specification */
+#define HID_ITEM_MAIN		0
+#define HID_ITEM_GLOBAL		1
+#define HID_ITEM_LOCAL		2
+#define HID_ITEM_LONG		0xfe
+
+#define HID_MAIN_INPUT		0x8
+#define HID_MAIN_COLLECTION	0xa
+#define HID_MAIN_END_COLLECTION	0xc
+
+#define HID_GLOBAL_USAGE_PAGE	0x0
+#define HID_GLOBAL_REPORT_SIZE	0x7
+#define HID_GLOBAL_REPORT_ID	0x8
+#define HID_GLOBAL_REPORT_COUNT	0x9
+#define HID_GLOBAL_PUSH		0xa
+#define HID_GLOBAL_POP		0xb
+
+#define HID_LOCAL_USAGE		0x0
+#define HID_LOCAL_USAGE_MIN	0x1
+#define HID_LOCAL_USAGE_MAX	0x2
+
+/* input item flags */
+#define HID_CONSTANT		(1 << 0)
+#define HID_VARIABLE		(1 << 1)
+#define HID_RELATIVE		(1 << 2)
+
+#define HID_PAGE_DESKTOP	0x01
+#define HID_PAGE_BUTTON		0x09
+/* X, Y, Z, Rx, Ry, Rz, Slider, Dial and Wheel */
+#define HID_DESKTOP_X		0x30
+#define HID_DESKTOP_WHEEL	0x38
+
+#define HID_MAX_USAGES		64
+/* the biggest report the kernel takes, in bytes */
+#define HID_MAX_BUFFER_SIZE	16384
+#define HID_STACK_DEPTH		4
+
+struct hid_globals {
+	uint32_t usage_page;
+	uint32_t report_size;
+	uint32_t report_count;
+	int report_id;
+};
+
+struct hid_locals {
+	uint32_t usages[HID_MAX_USAGES];
+	int nusages;
+	uint32_t usage_min;
+	uint32_t usage_max;
+	int range;
+};
+
+/* usage of the n-th field of a main item, with its page in the high half */
+static uint32_t field_usage(const struct hid_globals *g,
+			    const struct hid_locals *l, int n)
+{
+	uint32_t usage;
+
+	if (n < l->nusages)
+		usage = l->usages[n];
+	else if (l->range && l->usage_min + n - l->nusages <= l->usage_max)
+		usage = l->usage_min + n - l->nusages;
+	else if (l->nusages)
+		usage = l->usages[l->nusages - 1];
+	else
+		return 0;
+	if (usage <= 0xffff)
+		usage |= g->usage_page << 16;
+	return usage;
+}
+
+static int add_button(struct hid_plan *plan, unsigned int offset,
+		      unsigned int key)
+{
+	struct hid_segment *seg;
+
+	if (key >= XKEYS_MAX_KEYS)
+		return 0;
+	if (key >= plan->nkeys)
+		plan->nkeys = key + 1;
+
+	if (plan->nsegments) {
+		seg = &plan->segments[plan->nsegments - 1];
+		if (offset == seg->offset + seg->size &&
+		    key == seg->key + seg->size && key % 64 != 0 &&
+		    seg->size < HID_MAX_SEGMENT_BITS) {
+			seg->size++;
+			return 0;
+		}
+	}
+	if (plan->nsegments == HID_MAX_SEGMENTS) {
+		log_err("Too many button groups in the HID report descriptor\n");
+		return 1;
+	}
+	seg = &plan->segments[plan->nsegments++];
+	seg->offset = offset;
+	seg->size = 1;
+	seg->key = key;
+	return 0;
+}
+
+static void add_dial(struct hid_plan *plan, unsigned int offset,
+		     unsigned int size)
+{
+	if (plan->ndials == 2 || size > 32)
+		return;
+	plan->dials[plan->ndials].offset = offset;
+	plan->dials[plan->ndials].size = size;
+	plan->ndials++;
+}
+
+/*
+ * goes through the input fields of a main item. only the report of the
+ * first button or relative control is used, the other reports are ignored
+ */
+static int input_item(struct hid_plan *plan, const struct hid_globals *g,
+		      const struct hid_locals *l, uint32_t flags,
+		      unsigned int *offsets)
+{
+	unsigned int id = g->report_id < 0 ? 0 : g->report_id;
+	unsigned int offset, i;
+	uint32_t usage;
+
+	for (i = 0; i < g->report_count; i++) {
+		offset = offsets[id];
+		offsets[id] += g->report_size;
+		if ((flags & HID_CONSTANT) || !(flags & HID_VARIABLE))
+			continue;
+
+		usage = field_usage(g, l, i);
+		if (usage >> 16 == HID_PAGE_BUTTON && g->report_size == 1 &&
+		    (usage & 0xffff)) {
+			if (plan->report_id == -2)
+				plan->report_id = g->report_id;
+			if (plan->report_id != g->report_id)
+				continue;
+			if (add_button(plan, offset, (usage & 0xffff) - 1))
+				return 1;
+		} else if (usage >> 16 == HID_PAGE_DESKTOP &&
+			   (flags & HID_RELATIVE) &&
+			   (usage & 0xffff) >= HID_DESKTOP_X &&
+			   (usage & 0xffff) <= HID_DESKTOP_WHEEL) {
+			if (plan->report_id == -2)
+				plan->report_id = g->report_id;
+			if (plan->report_id != g->report_id)
+				continue;
+			add_dial(plan, offset, g->report_size);
+		}
+	}
+	return 0;
+}
+
+int hid_plan_compile(const unsigned char *desc, int size,
+		     struct hid_plan *plan)
+{
+	struct hid_globals g, stack[HID_STACK_DEPTH];
+	struct hid_locals l;
+	unsigned int offsets[256];
+	int i = 0, depth = 0, type, tag, len, n;
+	uint32_t data;
+
+	memset(plan, 0, sizeof(*plan));
+	memset(&g, 0, sizeof(g));
+	memset(&l, 0, sizeof(l));
+	plan->report_id = -2;		/* not known yet */
+	g.report_id = -1;
+	memset(offsets, 0, sizeof(offsets));
+
+	while (i < size) {
+		if (desc[i] == HID_ITEM_LONG) {
+			if (i + 1 >= size)
+				goto bad;
+			i += 3 + desc[i + 1];
+			continue;
+		}
+		len = desc[i] & 3;
+		if (len == 3)
+			len = 4;
+		type = (desc[i] >> 2) & 3;
+		tag = desc[i] >> 4;
+		if (i + 1 + len > size)
+			goto bad;
+		for (data = 0, n = 0; n < len; n++)
+			data |= (uint32_t)desc[i + 1 + n] << (n * 8);
+		i += 1 + len;
+
+		switch (type) {
+		case HID_ITEM_MAIN:
+			/* fields past the end of any report are made up */
+			if (tag == HID_MAIN_INPUT &&
+			    (uint64_t)g.report_size * g.report_count >
+			    HID_MAX_BUFFER_SIZE * 8 -
+			    offsets[g.report_id < 0 ? 0 : g.report_id])
+				goto bad;
+			if (tag == HID_MAIN_INPUT &&
+			    input_item(plan, &g, &l, data, offsets))
+				return 1;
+			memset(&l, 0, sizeof(l));
+			break;
+		case HID_ITEM_GLOBAL:
+			switch (tag) {
+			case HID_GLOBAL_USAGE_PAGE:
+				g.usage_page = data;
+				break;
+			case HID_GLOBAL_REPORT_SIZE:
+				if (data > 64)
+					goto bad;
+				g.report_size = data;
+				break;
+			case HID_GLOBAL_REPORT_ID:
+				if (data == 0 || data > 255)
+					goto bad;
+				g.report_id = data;
+				/* numbered reports start with the id */
+				if (offsets[data] == 0)
+					offsets[data] = 8;
+				break;
+			case HID_GLOBAL_REPORT_COUNT:
+				g.report_count = data;
+				break;
+			case HID_GLOBAL_PUSH:
+				if (depth == HID_STACK_DEPTH)
+					goto bad;
+				stack[depth++] = g;
+				break;
+			case HID_GLOBAL_POP:
+				if (depth == 0)
+					goto bad;
+				g = stack[--depth];
+				break;
+			}
+			break;
+		case HID_ITEM_LOCAL:
+			switch (tag) {
+			case HID_LOCAL_USAGE:
+				if (l.nusages < HID_MAX_USAGES)
+					l.usages[l.nusages++] = data;
+				break;
+			case HID_LOCAL_USAGE_MIN:
+				l.usage_min = data;
+				l.range = 1;
+				break;
+			case HID_LOCAL_USAGE_MAX:
+				l.usage_max = data;
+				break;
+			}
+			break;
+		}
+	}
+
+	if (plan->report_id == -2) {
+		log_err("No buttons or relative controls in the HID report descriptor\n");
+		return 1;
+	}
+	plan->report_size = (offsets[plan->report_id < 0 ? 0 : plan->report_id] + 7) / 8;
+	if (plan->report_size > XKEYS_READ_SIZE) {
+		log_err("HID reports of %u bytes are not supported\n",
+			plan->report_size);
+		return 1;
+	}
+	return 0;
+bad:
+	log_err("Invalid HID report descriptor\n");
+	return 1;
+}
@@ -0,0 +1,82 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef HIDDESC_H
+#define HIDDESC_H
+#include <stdint.h>
+
+#include "xkeys.h"
+
+/*
+ * decoding of devices that aren't X-keys: their HID report descriptor is
+ * parsed once into a plan saying where each button and relative control
+ * is in the report, and decoding a report only follows the plan.
+ * buttons become keys by their usage, Button 1 being key0. consecutive
+ * buttons are merged into segments, extracted with a single shift
+ */
+#define HID_MAX_SEGMENTS	16
+/* a segment never crosses a key word and fits a 64 bit load when shifted */
+#define HID_MAX_SEGMENT_BITS	56
+
+struct hid_segment {
+	uint16_t offset;	/* in bits, from the start of the report */
+	unsigned char size;	/* in bits, one per button */
+	unsigned char key;	/* key of the first button */
+};
+
+struct hid_dial {
+	uint16_t offset;	/* in bits */
+	unsigned char size;
+};
+
+struct hid_plan {
+	int report_id;		/* -1 if the reports aren't numbered */
+	unsigned int report_size;	/* in bytes, with the id */
+	unsigned int nkeys;	/* highest key + 1 */
+	unsigned int nsegments;
+	struct hid_segment segments[HID_MAX_SEGMENTS];
+	unsigned int ndials;
+	struct hid_dial dials[2];
+};
+
+/* HID fields are little endian, and may start anywhere in a byte */
+static inline uint64_t hid_get_bits(const unsigned char *report,
+				    unsigned int offset, unsigned int size)
+{
+	const unsigned char *p = report + offset / 8;
+	unsigned int i, nbytes = (offset % 8 + size + 7) / 8;
+	uint64_t value = 0;
+
+	for (i = 0; i < nbytes; i++)
+		value |= (uint64_t)p[i] << (i * 8);
+	value >>= offset % 8;
+	return size == 64 ? value : value & ((1ULL << size) - 1);
+}
+
+static inline int32_t hid_get_signed(const unsigned char *report,
+				     unsigned int offset, unsigned int size)
+{
+	uint64_t value = hid_get_bits(report, offset, size);
+
+	if (value & (1ULL << (size - 1)))
+		value |= ~0ULL << size;
+	return (int32_t)value;
+}
+
+int hid_plan_compile(const unsigned char *desc, int size,
+		     struct hid_plan *plan);
+#endif	/* HIDDESC_H */
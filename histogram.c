@@ -0,0 +1,49 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "histogram.h"
+
+static uint64_t bucket_limit(int bucket)
+{
+	int shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+	uint64_t base;
+
+	if (bucket < HISTOGRAM_SUB_BUCKETS)
+		return bucket;
+	base = HISTOGRAM_SUB_BUCKETS | (bucket & (HISTOGRAM_SUB_BUCKETS - 1));
+	/* last value that still falls in the bucket */
+	return ((base + 1) << shift) - 1;
+}
+
+uint64_t histogram_percentile(const struct histogram *h, unsigned int permille)
+{
+	uint64_t wanted, seen = 0;
+	int i;
+
+	if (h->samples == 0)
+		return 0;
+
+	wanted = (h->samples * permille + 999) / 1000;
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += h->count[i];
+		if (seen >= wanted)
+			break;
+	}
+	if (i == HISTOGRAM_BUCKETS)
+		return h->max;
+	return bucket_limit(i) < h->max ? bucket_limit(i) : h->max;
+}
@@ -0,0 +1,60 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+#include <stdint.h>
+
+/*
+ * log bucketed histogram: every power of two is split in
+ * HISTOGRAM_SUB_BUCKETS linear buckets, so the error of a percentile is
+ * at most 1/HISTOGRAM_SUB_BUCKETS of the value, from nanoseconds up to
+ * minutes. adding a sample is a couple of shifts and an increment, with
+ * no locking: each histogram has a single writer, the main loop
+ */
+#define HISTOGRAM_SUB_BITS	3
+#define HISTOGRAM_SUB_BUCKETS	(1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS	((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+struct histogram {
+	uint32_t count[HISTOGRAM_BUCKETS];
+	uint64_t samples;
+	uint64_t max;
+};
+
+static inline int histogram_bucket(uint64_t value)
+{
+	int msb;
+
+	if (value < HISTOGRAM_SUB_BUCKETS)
+		return value;
+	msb = 63 - __builtin_clzll(value);
+	return ((msb - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) |
+	       ((value >> (msb - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+static inline void histogram_add(struct histogram *h, uint64_t value)
+{
+	h->count[histogram_bucket(value)]++;
+	h->samples++;
+	if (value > h->max)
+		h->max = value;
+}
+
+/* returns the upper bound of the bucket holding the given per mille */
+uint64_t histogram_percentile(const struct histogram *h, unsigned int permille);
+#endif	/* HISTOGRAM_H */
@@ -0,0 +1,112 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "log.h"
+#include "loop.h"
+#include "hotplug.h"
+
+#define UEVENT_BUFFER_SIZE	8192
+
+static struct loop_source hotplug_source;
+static hotplug_cb hotplug_callback;
+static int hotplug_fd = -1;
+
+static void parse_uevent(char *buf, int size)
+{
+	const char *action = NULL, *subsystem = NULL, *devname = NULL;
+	char *ptr, *end = buf + size;
+
+	/* "action@devpath" followed by KEY=value strings */
+	for (ptr = buf + strlen(buf) + 1; ptr < end; ptr += strlen(ptr) + 1) {
+		if (!strncmp(ptr, "ACTION=", 7))
+			action = ptr + 7;
+		else if (!strncmp(ptr, "SUBSYSTEM=", 10))
+			subsystem = ptr + 10;
+		else if (!strncmp(ptr, "DEVNAME=", 8))
+			devname = ptr + 8;
+	}
+
+	if (action && subsystem && devname)
+		hotplug_callback(action, subsystem, devname);
+}
+
+static int hotplug_input(struct loop_source *source)
+{
+	char buf[UEVENT_BUFFER_SIZE];
+	struct sockaddr_nl addr;
+	struct iovec iov = {
+		.iov_base = buf,
+		.iov_len = sizeof(buf) - 1,
+	};
+	struct msghdr msg = {
+		.msg_name = &addr,
+		.msg_namelen = sizeof(addr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	ssize_t size;
+
+	while (1) {
+		size = recvmsg(hotplug_fd, &msg, 0);
+		if (size < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+			/* ENOBUFS: events were lost, nothing to do about it */
+			log_err("Error receiving uevent (%s)\n", strerror(errno));
+			break;
+		}
+		/* only trust the kernel */
+		if (addr.nl_pid != 0)
+			continue;
+		buf[size] = 0;
+		parse_uevent(buf, size);
+	}
+	return 0;
+}
+
+int hotplug_init(hotplug_cb cb)
+{
+	struct sockaddr_nl addr;
+
+	hotplug_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			    NETLINK_KOBJECT_UEVENT);
+	if (hotplug_fd < 0) {
+		log_err("Error creating uevent socket (%s)\n", strerror(errno));
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1;	/* kernel events */
+	if (bind(hotplug_fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		log_err("Error binding uevent socket (%s)\n", strerror(errno));
+		close(hotplug_fd);
+		hotplug_fd = -1;
+		return 1;
+	}
+
+	hotplug_callback = cb;
+	hotplug_source.handler = hotplug_input;
+	return loop_add(hotplug_fd, &hotplug_source);
+}
@@ -0,0 +1,29 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef HOTPLUG_H
+#define HOTPLUG_H
+
+/*
+ * called for every kernel uevent, with the ACTION, SUBSYSTEM and DEVNAME
+ * fields of the event. events without a device node are not reported
+ */
+typedef void (*hotplug_cb)(const char *action, const char *subsystem,
+			   const char *devname);
+
+int hotplug_init(hotplug_cb cb);
+#endif	/* HOTPLUG_H */
@@ -0,0 +1,52 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+/*
+ * shared between genevents, which builds the perfect hash of event names
+ * at build time, and input.c, which looks names up in it
+ */
+#ifndef INPUT_HASH_H
+#define INPUT_HASH_H
+#include <stdint.h>
+
+struct input_event_name {
+	const char *name;
+	uint16_t type;
+	uint16_t code;
+};
+
+/*
+ * the table is a two level "hash and displace" perfect hash: the name is
+ * hashed with seed 0 to pick a bucket, and the displacement stored for that
+ * bucket is the seed of the second hash, which gives the slot in the table.
+ * genevents picks the displacements so no two names share a slot
+ */
+static inline uint32_t input_event_hash(const char *name, uint32_t seed)
+{
+	uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619u;
+	}
+	h ^= h >> 15;
+	h *= 0x2c1b3c6du;
+	h ^= h >> 12;
+	return h;
+}
+
+#endif	/* INPUT_HASH_H */
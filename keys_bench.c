@@ -0,0 +1,170 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+/*
+ * microbenchmark for the key diff: compares the per-key table walk that
+ * device_input() used to do with the packed bitmask diff from xkeys.h, on
+ * the Jog & Shuttle layout
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "xkeys.h"
+
+#define NREPORTS	4096
+#define ROUNDS		2000
+
+#define XKEYS_NKEYS	46
+#define XKEYS_KEY_BYTES	9
+
+/* same as the Jog & Shuttle in device.c, with the keys at the start */
+static const struct xkeys_model jog_shuttle = {
+	.nkeys = XKEYS_NKEYS,
+	.keys = 0,
+	.nkey_bytes = XKEYS_KEY_BYTES,
+	.key_bytes = {
+		{ 0x7f, 0 }, { 0x7f, 7 },
+		{ 0x0f, 14 }, { 0x0f, 18 }, { 0x0f, 22 }, { 0x0f, 26 },
+		{ 0x7f, 30 }, { 0x7f, 37 },
+		{ 0x03, 44 },
+	},
+};
+
+/* the old byte/bit lookup table, kept here as the reference */
+static struct {
+	unsigned char byte;
+	unsigned char bit;
+} xkeys_key_bits[] = {
+	{ 0, 0 }, { 0, 1 }, { 0, 2 }, { 0, 3 }, { 0, 4 }, { 0, 5 }, { 0, 6 },
+	{ 1, 0 }, { 1, 1 }, { 1, 2 }, { 1, 3 }, { 1, 4 }, { 1, 5 }, { 1, 6 },
+	{ 2, 0 }, { 2, 1 }, { 2, 2 }, { 2, 3 },
+	{ 3, 0 }, { 3, 1 }, { 3, 2 }, { 3, 3 },
+	{ 4, 0 }, { 4, 1 }, { 4, 2 }, { 4, 3 },
+	{ 5, 0 }, { 5, 1 }, { 5, 2 }, { 5, 3 },
+	{ 6, 0 }, { 6, 1 }, { 6, 2 }, { 6, 3 }, { 6, 4 }, { 6, 5 }, { 6, 6 },
+	{ 7, 0 }, { 7, 1 }, { 7, 2 }, { 7, 3 }, { 7, 4 }, { 7, 5 }, { 7, 6 },
+	{ 8, 0 }, { 8, 1 },
+};
+
+static unsigned char reports[NREPORTS][XKEYS_KEY_BYTES];
+
+/* checksum of the changes seen, so both versions can be compared */
+static unsigned long sink;
+
+static void key_changed(int key, int pressed)
+{
+	sink = sink * 31 + key * 2 + pressed;
+}
+
+static void diff_loop(const unsigned char *last, const unsigned char *cur)
+{
+	unsigned char byte, bit;
+	int i;
+
+	if (!memcmp(last, cur, XKEYS_KEY_BYTES))
+		return;
+	for (i = 0; i < XKEYS_NKEYS; i++) {
+		byte = xkeys_key_bits[i].byte;
+		bit = 1 << xkeys_key_bits[i].bit;
+		if ((last[byte] & bit) == (cur[byte] & bit))
+			continue;
+		key_changed(i, (cur[byte] & bit) != 0);
+	}
+}
+
+static uint64_t diff_mask(uint64_t last, const unsigned char *cur)
+{
+	uint64_t keys, changed;
+	int i;
+
+	xkeys_pack_keys(&jog_shuttle, cur, &keys);
+	changed = keys ^ last;
+	for_each_changed_key(i, changed)
+		key_changed(i, (keys >> i) & 1);
+	return keys;
+}
+
+/* mostly single key transitions, like a person typing, with some chords */
+static void generate(void)
+{
+	unsigned char state[XKEYS_KEY_BYTES];
+	int i, n, key;
+
+	memset(state, 0, sizeof(state));
+	srand(1);
+	for (i = 0; i < NREPORTS; i++) {
+		n = (rand() % 8) ? 1 : 3;
+		while (n--) {
+			key = rand() % XKEYS_NKEYS;
+			state[xkeys_key_bits[key].byte] ^=
+				1 << xkeys_key_bits[key].bit;
+		}
+		memcpy(reports[i], state, sizeof(state));
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned char zero[XKEYS_KEY_BYTES];
+	unsigned long loop_sum, mask_sum;
+	uint64_t last;
+	double start, loop_ns, mask_ns;
+	int i, r;
+
+	generate();
+	memset(zero, 0, sizeof(zero));
+
+	sink = 0;
+	start = now();
+	for (r = 0; r < ROUNDS; r++) {
+		diff_loop(zero, reports[0]);
+		for (i = 1; i < NREPORTS; i++)
+			diff_loop(reports[i - 1], reports[i]);
+	}
+	loop_ns = (now() - start) / ((double)ROUNDS * NREPORTS);
+	loop_sum = sink;
+
+	sink = 0;
+	start = now();
+	for (r = 0; r < ROUNDS; r++) {
+		last = 0;
+		for (i = 0; i < NREPORTS; i++)
+			last = diff_mask(last, reports[i]);
+	}
+	mask_ns = (now() - start) / ((double)ROUNDS * NREPORTS);
+	mask_sum = sink;
+
+	if (loop_sum != mask_sum) {
+		fprintf(stderr, "key diff mismatch (%lx != %lx)\n", loop_sum,
+			mask_sum);
+		return 1;
+	}
+
+	printf("key diff, per report: table loop %.2f ns, bitmask %.2f ns\n",
+	       loop_ns, mask_ns);
+	return 0;
+}
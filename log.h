@@ -0,0 +1,40 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef LOG_H
+#define LOG_H
+#include <stdio.h>
+#include <syslog.h>
+
+extern int run_as_daemon;
+
+#define log(x...) do { \
+	if (run_as_daemon) \
+		syslog(LOG_DAEMON|LOG_NOTICE, x); \
+	else \
+		printf(x); \
+	} while(0)
+
+#define log_err(x...) do { \
+	if (run_as_daemon) \
+		syslog(LOG_DAEMON|LOG_ERR, x); \
+	else \
+		fprintf(stderr, x); \
+	} while(0)
+
+
+#endif	/* LOG_H */
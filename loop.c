@@ -0,0 +1,87 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+#include "log.h"
+#include "loop.h"
+
+/* max number of ready file descriptors handled per epoll_wait() */
+#define EPOLL_MAX_EVENTS 16
+
+static int epfd = -1;
+
+int loop_init(void)
+{
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		log_err("Error creating epoll instance (%s)\n", strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+int loop_add(int fd, struct loop_source *source)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = source;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) {
+		log_err("Error adding file descriptor to epoll set (%s)\n", strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+int loop_del(int fd)
+{
+	if (epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL)) {
+		log_err("Error removing file descriptor from epoll set (%s)\n", strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+int loop_run(void)
+{
+	struct epoll_event events[EPOLL_MAX_EVENTS];
+	struct loop_source *source;
+	int ret, i;
+
+	while(1) {
+		/* no timeout: only wake up when there's something to do */
+		ret = epoll_wait(epfd, events, EPOLL_MAX_EVENTS, -1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			log_err("Error waiting for file descriptors to become available (%s)\n", strerror(errno));
+			return 1;
+		}
+		for (i = 0; i < ret; i++) {
+			source = events[i].data.ptr;
+			if (source->handler(source))
+				return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,48 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef LOOP_H
+#define LOOP_H
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+/*
+ * anything waited on by the main loop: devices, signals, timers. the
+ * handler is called when the file descriptor it was added with becomes
+ * readable, returning non zero stops the loop
+ */
+struct loop_source {
+	int (*handler)(struct loop_source *source);
+};
+
+static inline uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int loop_init(void);
+int loop_add(int fd, struct loop_source *source);
+int loop_del(int fd);
+int loop_run(void);
+#endif	/* LOOP_H */
@@ -0,0 +1,92 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdint.h>
+
+#include "log.h"
+#include "device.h"
+#include "timer.h"
+#include "macro.h"
+
+struct macro_run {
+	struct timer timer;
+	struct device *dev;		/* NULL if the slot is free */
+	const struct macro *macro;
+	unsigned int next;		/* first event still to be sent */
+};
+
+static struct macro_run runs[MACRO_MAX_RUNS];
+
+/* runs the next steps of a sequence once its delay is over */
+static int run_expired(struct timer *timer)
+{
+	struct macro_run *run = container_of(timer, struct macro_run, timer);
+	struct device *dev = run->dev;
+
+	run->dev = NULL;
+	/* it may schedule the step after this one */
+	return device_macro_step(dev, run->macro, run->next);
+}
+
+/*
+ * the events of the macro from 'next' on are sent after 'delay' ms.
+ * returns 1 if they can't be scheduled, it's up to the caller to send
+ * them right away then. a delay always comes after the release of the
+ * block before it, so sending the rest early never leaves a key pressed
+ */
+int macro_schedule(struct device *dev, const struct macro *macro,
+		   unsigned int next, unsigned int delay)
+{
+	struct macro_run *run = NULL;
+	int i;
+
+	if (!timers_enabled())
+		return 1;
+	for (i = 0; i < MACRO_MAX_RUNS && run == NULL; i++)
+		if (runs[i].dev == NULL)
+			run = &runs[i];
+	if (run == NULL) {
+		/* the first time is logged, SIGUSR1 tells how many more */
+		if (dev->out.skipped_delays++ == 0)
+			log_err("Too many macros running on \"%s\", skipping their delays\n",
+				dev->name);
+		return 1;
+	}
+
+	run->dev = dev;
+	run->macro = macro;
+	run->next = next;
+	timer_setup(&run->timer, run_expired);
+	if (timer_add(&run->timer, delay)) {
+		run->dev = NULL;
+		return 1;
+	}
+	return 0;
+}
+
+/* the sequences of a device going away or switching mapping are dropped */
+void macro_cancel(struct device *dev)
+{
+	int i;
+
+	for (i = 0; i < MACRO_MAX_RUNS; i++)
+		if (runs[i].dev == dev) {
+			timer_del(&runs[i].timer);
+			runs[i].dev = NULL;
+		}
+}
@@ -0,0 +1,34 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef MACRO_H
+#define MACRO_H
+
+struct device;
+struct macro;
+
+/*
+ * the rest of a macro sequence waiting on a delay. the runs of every
+ * device are timers in the daemon's timer wheel, so sequences progress
+ * concurrently and never block the reads
+ */
+#define MACRO_MAX_RUNS	64
+
+int macro_schedule(struct device *dev, const struct macro *macro,
+		   unsigned int next, unsigned int delay);
+void macro_cancel(struct device *dev);
+#endif	/* MACRO_H */
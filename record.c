@@ -0,0 +1,199 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "device.h"
+#include "record.h"
+#include "loop.h"
+
+static int record_fd = -1;
+
+static int check_header(const struct record_header *header)
+{
+	if (memcmp(header->magic, RECORD_MAGIC, sizeof(header->magic)) ||
+	    header->version != RECORD_VERSION ||
+	    header->entry_size != sizeof(struct record_entry) ||
+	    header->report_size != XKEYS_READ_SIZE)
+		return 1;
+	return 0;
+}
+
+int record_open(const char *filename)
+{
+	struct record_header header;
+	struct stat st;
+	int fd;
+
+	fd = open(filename, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		log_err("Error opening record file %s (%s)\n", filename,
+			strerror(errno));
+		return 1;
+	}
+	if (fstat(fd, &st))
+		goto err;
+
+	if (st.st_size == 0) {
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, RECORD_MAGIC, sizeof(header.magic));
+		header.version = RECORD_VERSION;
+		header.entry_size = sizeof(struct record_entry);
+		header.report_size = XKEYS_READ_SIZE;
+		if (write(fd, &header, sizeof(header)) != sizeof(header))
+			goto err;
+	} else {
+		/* appending to an existing recording, it has to match */
+		if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+		    check_header(&header) ||
+		    (st.st_size - sizeof(header)) % sizeof(struct record_entry)) {
+			log_err("%s is not a valid record file\n", filename);
+			close(fd);
+			return 1;
+		}
+	}
+
+	record_fd = fd;
+	return 0;
+err:
+	log_err("Error setting up record file %s (%s)\n", filename,
+		strerror(errno));
+	close(fd);
+	return 1;
+}
+
+void record_report(struct device *dev, const unsigned char *report, int size)
+{
+	struct record_entry entry;
+
+	if (record_fd < 0)
+		return;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.timestamp = monotonic_ns();
+	entry.vendor = dev->vendor;
+	entry.product = dev->product;
+	entry.device = dev->id;
+	entry.size = size > sizeof(entry.report) ? sizeof(entry.report) : size;
+	memcpy(entry.report, report, entry.size);
+
+	/* a single write with O_APPEND, so entries never interleave */
+	if (write(record_fd, &entry, sizeof(entry)) != sizeof(entry)) {
+		log_err("Error writing to record file (%s), recording stopped\n",
+			strerror(errno));
+		close(record_fd);
+		record_fd = -1;
+	}
+}
+
+/*
+ * a file appended to across daemon runs or reboots has timestamps that jump
+ * back, or far ahead. such a gap is replayed as no gap at all
+ */
+#define REPLAY_MAX_GAP	(60 * 1000000000ULL)
+
+/*
+ * feeds every recorded report to the device it was read from. at original
+ * speed the time between reports is kept, otherwise they're sent as fast
+ * as possible
+ */
+int replay_file(const char *filename, struct device *devices, int count,
+		int fast)
+{
+	const struct record_header *header;
+	const struct record_entry *entry;
+	struct timespec ts;
+	uint64_t prev = 0, when;
+	size_t nentries, i;
+	struct stat st;
+	void *map;
+	int fd, ret = 0;
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		log_err("Error opening replay file %s (%s)\n", filename,
+			strerror(errno));
+		return 1;
+	}
+	if (fstat(fd, &st) || st.st_size < sizeof(*header)) {
+		log_err("%s is not a valid record file\n", filename);
+		close(fd);
+		return 1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		log_err("Error mapping replay file %s (%s)\n", filename,
+			strerror(errno));
+		return 1;
+	}
+
+	header = map;
+	if (check_header(header)) {
+		log_err("%s is not a valid record file\n", filename);
+		ret = 1;
+		goto out;
+	}
+	entry = (const struct record_entry *)(header + 1);
+	nentries = (st.st_size - sizeof(*header)) / sizeof(*entry);
+	if (nentries)
+		prev = entry->timestamp;
+
+	when = monotonic_ns();
+	for (i = 0; i < nentries; i++, entry++) {
+		if (entry->timestamp < prev ||
+		    entry->timestamp - prev > REPLAY_MAX_GAP)
+			log("Recorded time jumps at report %zu, replaying it without delay\n",
+			    i);
+		else
+			when += entry->timestamp - prev;
+		prev = entry->timestamp;
+
+		if (entry->device >= count ||
+		    (devices[entry->device].uinput < 0 &&
+		     devices[entry->device].ring == NULL) ||
+		    devices[entry->device].vendor != entry->vendor ||
+		    devices[entry->device].product != entry->product) {
+			log_err("Recorded report doesn't match any device, skipping\n");
+			continue;
+		}
+
+		if (!fast) {
+			ts.tv_sec = when / 1000000000ULL;
+			ts.tv_nsec = when % 1000000000ULL;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					       &ts, NULL) == EINTR)
+				;
+		}
+
+		ret = device_report(&devices[entry->device], entry->report,
+				    entry->size, monotonic_ns());
+		if (ret)
+			break;
+	}
+out:
+	munmap(map, st.st_size);
+	return ret;
+}
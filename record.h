@@ -0,0 +1,54 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef RECORD_H
+#define RECORD_H
+#include <stdint.h>
+
+#include "device.h"
+
+/*
+ * record file layout: a header followed by fixed size entries, one per
+ * report read from a device, in the order they were read. entries are only
+ * ever appended, and being fixed size the file can be mmapped and indexed
+ * directly. all fields are in host byte order.
+ */
+#define RECORD_MAGIC	"XKRR"
+#define RECORD_VERSION	1
+
+struct record_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t entry_size;	/* sizeof(struct record_entry) */
+	uint32_t report_size;	/* size of record_entry.report */
+	uint32_t reserved;
+};
+
+struct record_entry {
+	uint64_t timestamp;	/* CLOCK_MONOTONIC, in ns */
+	uint16_t vendor;
+	uint16_t product;
+	uint16_t device;	/* device position in the configuration */
+	uint16_t size;		/* bytes used in report[] */
+	unsigned char report[XKEYS_READ_SIZE];
+};
+
+int record_open(const char *filename);
+void record_report(struct device *dev, const unsigned char *report, int size);
+int replay_file(const char *filename, struct device *devices, int count,
+		int fast);
+#endif	/* RECORD_H */
@@ -0,0 +1,322 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+/*
+ * benchmark for the report to uinput path: synthetic hidraw reports are fed
+ * through device_input() over a SOCK_SEQPACKET socket, which keeps report
+ * boundaries like hidraw does, and the events end up in a memfd standing in
+ * for uinput. read(), write() and the allocators are wrapped by the linker
+ * (see the Makefile) so syscalls and allocations can be counted. every
+ * workload is run with read() and write() and then with io_uring, where
+ * the io_uring_enter() calls are the syscalls. both have to write as many
+ * events, or the io_uring path isn't summing up motion the same way
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "log.h"
+#include "device.h"
+#include "loop.h"
+#include "uring.h"
+
+int run_as_daemon;
+
+/* reports queued in the socket before draining them through device_input */
+#define CHUNK		64
+#define NREPORTS	(CHUNK * 1024)
+
+static unsigned long nr_syscalls, nr_allocs, nr_processed;
+static int counting;
+
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __real_write(int fd, const void *buf, size_t count);
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+int __real_device_process(struct device *dev, const void *buf, int size,
+			  uint64_t start);
+
+ssize_t __wrap_read(int fd, void *buf, size_t count)
+{
+	nr_syscalls += counting;
+	return __real_read(fd, buf, count);
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t count)
+{
+	nr_syscalls += counting;
+	return __real_write(fd, buf, count);
+}
+
+void *__wrap_malloc(size_t size)
+{
+	nr_allocs += counting;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	nr_allocs += counting;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	nr_allocs += counting;
+	return __real_realloc(ptr, size);
+}
+
+/* only calls from uring.c are wrapped, to know when a chunk is done */
+int __wrap_device_process(struct device *dev, const void *buf, int size,
+			  uint64_t start)
+{
+	nr_processed++;
+	return __real_device_process(dev, buf, size, start);
+}
+
+static unsigned char reports[NREPORTS][XKEYS_READ_SIZE];
+
+/* the reports are the ones of a Jog & Shuttle */
+static const struct xkeys_model *model;
+
+static void report_init(unsigned char *report, unsigned char *prev)
+{
+	if (prev)
+		memcpy(report, prev, XKEYS_READ_SIZE);
+	else
+		memset(report, 0, XKEYS_READ_SIZE);
+	report[model->type_offset] = model->type;
+}
+
+static void set_key(unsigned char *report, int key, int pressed)
+{
+	int i;
+
+	for (i = model->nkey_bytes - 1; i >= 0; i--)
+		if (key >= model->key_bytes[i].shift)
+			break;
+	key -= model->key_bytes[i].shift;
+	if (pressed)
+		report[model->keys + i] |= 1 << key;
+	else
+		report[model->keys + i] &= ~(1 << key);
+}
+
+/* the jog wheel spun continuously in one direction, then back */
+static void gen_jog_spin(void)
+{
+	int i;
+
+	for (i = 0; i < NREPORTS; i++) {
+		report_init(reports[i], i ? reports[i - 1] : NULL);
+		reports[i][model->jog] += (i / 512) % 2 ? -1 : 1;
+	}
+}
+
+/* the shuttle swept from one end to the other and back */
+static void gen_shuttle_sweep(void)
+{
+	int i, pos = 0, dir = 1;
+
+	for (i = 0; i < NREPORTS; i++) {
+		report_init(reports[i], i ? reports[i - 1] : NULL);
+		pos += dir;
+		if (pos == 7 || pos == -7)
+			dir = -dir;
+		reports[i][model->shuttle] = pos;
+	}
+}
+
+/* mapped keys pressed and released together, while jogging */
+static void gen_chord_storm(void)
+{
+	static const int chord[] = { 0, 1, 2, 3, 4, 5 };
+	int i, k;
+
+	for (i = 0; i < NREPORTS; i++) {
+		report_init(reports[i], i ? reports[i - 1] : NULL);
+		for (k = 0; k < sizeof(chord) / sizeof(chord[0]); k++)
+			set_key(reports[i], chord[k], !(i % 2));
+		reports[i][model->jog] += 1;
+	}
+}
+
+static const struct {
+	const char *name;
+	void (*generate)(void);
+} workloads[] = {
+	{ "jog spin", gen_jog_spin },
+	{ "shuttle sweep", gen_shuttle_sweep },
+	{ "chord storm", gen_chord_storm },
+};
+
+/* same mappings as sample.conf */
+static const char *mappings[] = {
+	"KEY_A",
+	"KEY_X;KEY_K;KEY_E;KEY_Y;KEY_D",
+	"KEY_LEFTCTRL+KEY_LEFTALT+KEY_F1",
+	"KEY_LEFTCTRL+KEY_LEFTALT+KEY_R;KEY_ESC",
+	"KEY_E",
+	"KEY_F",
+};
+
+static struct mapping mapping;
+
+static int setup_device(struct device *dev, int *feed)
+{
+	struct input_translate *priv = input_translate_init();
+	int sv[2], i;
+	char buf[64];
+
+	memset(dev, 0, sizeof(*dev));
+	snprintf(dev->name, sizeof(dev->name), "bench");
+	dev->mapping = &mapping;
+	dev->active = &mapping;
+	if (device_set_model(dev, XKEYS_PRODUCT))
+		return 1;
+	model = dev->model;
+	for (i = 0; i < sizeof(mappings) / sizeof(mappings[0]); i++) {
+		snprintf(buf, sizeof(buf), "%s", mappings[i]);
+		if (compile_macro(priv, buf, &mapping.keys[i]))
+			return 1;
+	}
+	mapping.axles[0] = REL_X;
+	mapping.axles[1] = REL_Y;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, sv)) {
+		fprintf(stderr, "Unable to create socket pair (%s)\n", strerror(errno));
+		return 1;
+	}
+	dev->fd = sv[0];
+	*feed = sv[1];
+
+	dev->uinput = memfd_create("uinput", 0);
+	if (dev->uinput < 0) {
+		fprintf(stderr, "Unable to create memfd (%s)\n", strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* a single wakeup reads the whole chunk, io_uring may take a few rounds */
+static int drain(struct device *dev)
+{
+	if (!dev->uring)
+		return device_input(dev);
+
+	nr_processed = 0;
+	while (nr_processed < CHUNK)
+		if (uring_wait())
+			return 1;
+	return 0;
+}
+
+/* events written for each workload with read() and write() */
+static unsigned long expected[sizeof(workloads) / sizeof(workloads[0])];
+
+static int run(struct device *dev, int feed, const char *name,
+	       unsigned long *written)
+{
+	unsigned long enters = uring_enters;
+	double start, elapsed = 0;
+	int i, j;
+
+	/* each workload is reported on its own */
+	nr_syscalls = nr_allocs = 0;
+	dev->out.events = dev->out.flushes = 0;
+	memset(&dev->last, 0, sizeof(dev->last));
+	memset(dev->latency, 0, sizeof(dev->latency));
+	for (i = 0; i < NREPORTS; i += CHUNK) {
+		for (j = i; j < i + CHUNK; j++)
+			if (__real_write(feed, reports[j], XKEYS_READ_SIZE) != XKEYS_READ_SIZE) {
+				fprintf(stderr, "Error feeding report (%s)\n", strerror(errno));
+				return 1;
+			}
+
+		counting = 1;
+		start = now();
+		if (drain(dev))
+			return 1;
+		elapsed += now() - start;
+		counting = 0;
+
+		/* keep the memfd from growing without bounds */
+		lseek(dev->uinput, 0, SEEK_SET);
+	}
+
+	nr_syscalls += uring_enters - enters;
+	/* the last writes are accounted for once they completed */
+	if (dev->uring && uring_sync())
+		return 1;
+	printf("%-24s %8.1f ns/report %6.2f syscalls/report %6.2f allocs/report %6.2f events/report\n",
+	       name, elapsed / NREPORTS, (double)nr_syscalls / NREPORTS,
+	       (double)nr_allocs / NREPORTS,
+	       (double)dev->out.events / NREPORTS);
+	device_dump_stats(dev);
+	*written = dev->out.events;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct device dev;
+	unsigned long written;
+	char name[32];
+	int i, feed;
+
+	if (setup_device(&dev, &feed))
+		return 1;
+
+	for (i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+		workloads[i].generate();
+		if (run(&dev, feed, workloads[i].name, &expected[i]))
+			return 1;
+	}
+
+	if (loop_init() || uring_init() || device_attach(&dev)) {
+		printf("io_uring not available, skipping\n");
+		return 0;
+	}
+	for (i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+		workloads[i].generate();
+		snprintf(name, sizeof(name), "%s (io_uring)", workloads[i].name);
+		if (run(&dev, feed, name, &written))
+			return 1;
+		/* reports read together are batched together, whatever the path */
+		if (written != expected[i]) {
+			fprintf(stderr, "%s: %lu events written, %lu with read()\n",
+				name, written, expected[i]);
+			return 1;
+		}
+	}
+	return 0;
+}
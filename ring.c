@@ -0,0 +1,122 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "loop.h"
+#include "device.h"
+#include "ring.h"
+
+/* what the writer keeps, the readers only see the mapping */
+struct ring {
+	struct ring_header *header;
+	struct ring_event *events;
+	uint64_t head;
+	uint32_t mask;
+	size_t size;
+	char name[RING_NAME_SIZE];
+};
+
+/*
+ * creates the segment for the device. one left behind by a previous run
+ * is unlinked first, readers still mapping it keep the old one
+ */
+struct ring *ring_open(struct device *dev)
+{
+	struct ring *ring;
+	size_t size;
+	void *map;
+	int fd;
+
+	ring = calloc(1, sizeof(*ring));
+	if (ring == NULL) {
+		log_err("Not enough memory for the event ring\n");
+		return NULL;
+	}
+	snprintf(ring->name, sizeof(ring->name), "%s", dev->ring_name);
+	size = sizeof(struct ring_header) +
+	       (size_t)dev->ring_size * sizeof(struct ring_event);
+
+	shm_unlink(ring->name);
+	fd = shm_open(ring->name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0)
+		goto err;
+	if (ftruncate(fd, size)) {
+		close(fd);
+		shm_unlink(ring->name);
+		goto err;
+	}
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		shm_unlink(ring->name);
+		goto err;
+	}
+
+	ring->header = map;
+	ring->events = (struct ring_event *)(ring->header + 1);
+	ring->mask = dev->ring_size - 1;
+	ring->size = size;
+	memcpy(ring->header->magic, RING_MAGIC, sizeof(ring->header->magic));
+	ring->header->version = RING_VERSION;
+	ring->header->header_size = sizeof(struct ring_header);
+	ring->header->event_size = sizeof(struct ring_event);
+	ring->header->size = dev->ring_size;
+	ring->header->device = dev->id;
+	snprintf(ring->header->name, sizeof(ring->header->name), "%s", dev->name);
+	return ring;
+err:
+	log_err("Error creating event ring %s (%s)\n", ring->name,
+		strerror(errno));
+	free(ring);
+	return NULL;
+}
+
+void ring_close(struct ring *ring)
+{
+	if (ring == NULL)
+		return;
+	munmap(ring->header, ring->size);
+	shm_unlink(ring->name);
+	free(ring);
+}
+
+/*
+ * the slot is marked as being written before it's touched and gets its
+ * sequence back once done, so a reader copying it meanwhile can tell
+ */
+void ring_publish(struct ring *ring, uint16_t type, uint16_t code,
+		  int32_t value)
+{
+	struct ring_event *ev = &ring->events[ring->head & ring->mask];
+
+	__atomic_store_n(&ev->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	ev->timestamp = monotonic_ns();
+	ev->type = type;
+	ev->code = code;
+	ev->value = value;
+	__atomic_store_n(&ev->seq, ++ring->head, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->header->head, ring->head, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,111 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef RING_H
+#define RING_H
+#include <stdint.h>
+
+/*
+ * event ring in shared memory, for local programs that want the decoded
+ * panel events without uinput. xkeysd is the only writer, any number of
+ * readers map the segment (/dev/shm/<name>) read only and follow it on
+ * their own, nobody waits for anybody. the oldest events are overwritten
+ * once the ring is full, a reader that falls that far behind notices and
+ * skips ahead.
+ *
+ * the segment is a struct ring_header followed by 'size' struct ring_event
+ * at 'header_size'. the event at position N (counting from 0 since the
+ * ring was created) is in slot N % size. everything is in host byte order
+ */
+#define RING_MAGIC		"XKRG"
+#define RING_VERSION		1
+#define RING_DEFAULT_SIZE	4096
+#define RING_MIN_SIZE		64
+#define RING_MAX_SIZE		(1 << 20)
+
+struct ring_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t header_size;	/* where the events start */
+	uint32_t event_size;	/* sizeof(struct ring_event) */
+	uint32_t size;		/* number of slots, a power of two */
+	uint32_t device;	/* position of the device in the configuration */
+	char name[64];		/* of the device */
+	/* events written so far, updated after each one is complete */
+	uint64_t head __attribute__((aligned(64)));
+} __attribute__((aligned(64)));
+
+enum ring_event_type {
+	RING_EVENT_KEY,		/* code is the key, value 1 pressed, 0 released */
+	RING_EVENT_DIAL,	/* code 0 is idial, 1 edial, value the motion */
+};
+
+struct ring_event {
+	/* position + 1 once the event is written, 0 while it's being written */
+	uint64_t seq;
+	uint64_t timestamp;	/* CLOCK_MONOTONIC, in ns, when it was decoded */
+	uint16_t type;		/* RING_EVENT_* */
+	uint16_t code;
+	int32_t value;
+	uint64_t reserved;
+};
+
+/*
+ * for readers: copies the event at position *pos, if it was written, and
+ * moves *pos past it. returns 1 with an event, 0 if there's nothing new
+ * yet, or -1 if the event was overwritten before it could be read, in
+ * which case *pos moves to the oldest event still in the ring. start with
+ * *pos set to head to only see new events
+ */
+static inline int ring_read(const struct ring_header *header, uint64_t *pos,
+			    struct ring_event *ev)
+{
+	const struct ring_event *slot;
+	uint64_t head, seq;
+
+	head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+	if (*pos >= head)
+		return 0;
+	if (head - *pos > header->size)
+		goto lost;
+	slot = (const struct ring_event *)((const char *)header +
+					   header->header_size) +
+	       (*pos & (header->size - 1));
+	seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+	if (seq != *pos + 1)
+		goto lost;
+	*ev = *slot;
+	/* the copy only counts if the slot wasn't rewritten meanwhile */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+		goto lost;
+	(*pos)++;
+	return 1;
+lost:
+	head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+	*pos = head > header->size ? head - header->size : 0;
+	return -1;
+}
+
+struct device;
+struct ring;
+
+struct ring *ring_open(struct device *dev);
+void ring_close(struct ring *ring);
+void ring_publish(struct ring *ring, uint16_t type, uint16_t code,
+		  int32_t value);
+#endif	/* RING_H */
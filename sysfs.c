@@ -0,0 +1,181 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+#include "sysfs.h"
+
+static int read_hex(const char *filename, uint16_t *value)
+{
+	unsigned int tmp;
+	FILE *file;
+	int ret;
+
+	file = fopen(filename, "re");
+	if (file == NULL)
+		return 1;
+	ret = fscanf(file, "%x", &tmp) != 1;
+	fclose(file);
+	*value = tmp;
+	return ret;
+}
+
+int sysfs_hidraw_info(const char *root, int num, struct sysfs_node *node)
+{
+	char filename[256], line[256];
+	unsigned int bus, vendor, product;
+	int found = 0;
+	FILE *file;
+
+	snprintf(filename, sizeof(filename), "%s/class/hidraw/hidraw%i/device/uevent",
+		 root, num);
+	file = fopen(filename, "re");
+	if (file == NULL)
+		return 1;
+
+	memset(node, 0, sizeof(*node));
+	node->num = num;
+	while (fgets(line, sizeof(line), file)) {
+		line[strcspn(line, "\n")] = 0;
+		/* HID_ID=0003:000005F3:000002B1 */
+		if (sscanf(line, "HID_ID=%x:%x:%x", &bus, &vendor, &product) == 3) {
+			node->bus = bus;
+			node->vendor = vendor;
+			node->product = product;
+			found = 1;
+		} else if (!strncmp(line, "HID_UNIQ=", 9))
+			snprintf(node->serial, sizeof(node->serial), "%.*s",
+				 (int)sizeof(node->serial) - 1, line + 9);
+	}
+	fclose(file);
+
+	return !found;
+}
+
+int sysfs_event_info(const char *root, int num, struct sysfs_node *node)
+{
+	char filename[256];
+	FILE *file;
+
+	memset(node, 0, sizeof(*node));
+	node->num = num;
+
+	snprintf(filename, sizeof(filename), "%s/class/input/event%i/device/id/bustype",
+		 root, num);
+	if (read_hex(filename, &node->bus))
+		return 1;
+	snprintf(filename, sizeof(filename), "%s/class/input/event%i/device/id/vendor",
+		 root, num);
+	if (read_hex(filename, &node->vendor))
+		return 1;
+	snprintf(filename, sizeof(filename), "%s/class/input/event%i/device/id/product",
+		 root, num);
+	if (read_hex(filename, &node->product))
+		return 1;
+
+	/* the serial is optional */
+	snprintf(filename, sizeof(filename), "%s/class/input/event%i/device/uniq",
+		 root, num);
+	file = fopen(filename, "re");
+	if (file == NULL)
+		return 0;
+	if (fgets(node->serial, sizeof(node->serial), file))
+		node->serial[strcspn(node->serial, "\n")] = 0;
+	fclose(file);
+	return 0;
+}
+
+/* the arrays grow by this many nodes at a time */
+#define SYSFS_NODES_STEP	64
+
+/* room for one more node at the end of the array */
+static struct sysfs_node *next_node(struct sysfs_node **nodes, int n)
+{
+	struct sysfs_node *tmp;
+
+	if (n % SYSFS_NODES_STEP == 0) {
+		tmp = realloc(*nodes, (n + SYSFS_NODES_STEP) * sizeof(*tmp));
+		if (tmp == NULL)
+			return NULL;
+		*nodes = tmp;
+	}
+	return &(*nodes)[n];
+}
+
+/*
+ * builds the index of hidraw and event nodes, without opening any of them.
+ * an index from an earlier scan is replaced, and left as it was if the scan
+ * fails
+ */
+int sysfs_scan(const char *root, struct sysfs_index *index)
+{
+	struct sysfs_index new = { 0 };
+	struct sysfs_node *node;
+	char dirname[256];
+	struct dirent *entry;
+	DIR *dir;
+	int num;
+
+	snprintf(dirname, sizeof(dirname), "%s/class/hidraw", root);
+	dir = opendir(dirname);
+	if (dir == NULL)
+		return 1;
+	while ((entry = readdir(dir))) {
+		if (sscanf(entry->d_name, "hidraw%i", &num) != 1)
+			continue;
+		node = next_node(&new.hidraw, new.nhidraw);
+		if (node == NULL)
+			goto err;
+		if (!sysfs_hidraw_info(root, num, node))
+			new.nhidraw++;
+	}
+	closedir(dir);
+
+	snprintf(dirname, sizeof(dirname), "%s/class/input", root);
+	dir = opendir(dirname);
+	if (dir == NULL)
+		goto err_free;
+	while ((entry = readdir(dir))) {
+		if (sscanf(entry->d_name, "event%i", &num) != 1)
+			continue;
+		node = next_node(&new.event, new.nevent);
+		if (node == NULL)
+			goto err;
+		if (!sysfs_event_info(root, num, node))
+			new.nevent++;
+	}
+	closedir(dir);
+
+	sysfs_free(index);
+	*index = new;
+	return 0;
+err:
+	closedir(dir);
+err_free:
+	sysfs_free(&new);
+	return 1;
+}
+
+void sysfs_free(struct sysfs_index *index)
+{
+	free(index->hidraw);
+	free(index->event);
+	memset(index, 0, sizeof(*index));
+}
@@ -0,0 +1,52 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef SYSFS_H
+#define SYSFS_H
+#include <stdint.h>
+
+/*
+ * device discovery through sysfs: ids are read from
+ * <root>/class/hidraw/hidrawN/device/uevent and
+ * <root>/class/input/eventN/device/{id/,uniq}, so only the device nodes that
+ * match get opened. root is "/sys" except when testing
+ */
+#define SYSFS_SERIAL_SIZE	64
+struct sysfs_node {
+	int num;		/* hidrawN or eventN */
+	uint16_t bus;
+	uint16_t vendor;
+	uint16_t product;
+	char serial[SYSFS_SERIAL_SIZE];
+};
+
+/*
+ * the node arrays grow with the number of nodes, sysfs_free() frees them.
+ * an index starts out zeroed
+ */
+struct sysfs_index {
+	struct sysfs_node *hidraw;
+	int nhidraw;
+	struct sysfs_node *event;
+	int nevent;
+};
+
+int sysfs_hidraw_info(const char *root, int num, struct sysfs_node *node);
+int sysfs_event_info(const char *root, int num, struct sysfs_node *node);
+int sysfs_scan(const char *root, struct sysfs_index *index);
+void sysfs_free(struct sysfs_index *index);
+#endif	/* SYSFS_H */
@@ -0,0 +1,162 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+/* runs the sysfs discovery against a fake sysfs tree */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "sysfs.h"
+
+static char root[] = "/tmp/xkeysd-sysfs.XXXXXX";
+
+/* creates path under root, with the directories leading to it */
+static int write_file(const char *path, const char *content)
+{
+	char filename[512];
+	FILE *file;
+	char *slash;
+
+	snprintf(filename, sizeof(filename), "%s/%s", root, path);
+	for (slash = filename + strlen(root) + 1; (slash = strchr(slash, '/'));
+	     slash++) {
+		*slash = 0;
+		if (mkdir(filename, 0755) && errno != EEXIST)
+			return 1;
+		*slash = '/';
+	}
+	file = fopen(filename, "w");
+	if (file == NULL)
+		return 1;
+	fputs(content, file);
+	fclose(file);
+	return 0;
+}
+
+static int remove_file(const char *path, const struct stat *st, int flag,
+		       struct FTW *ftw)
+{
+	return remove(path);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sysfs_index index = { 0 };
+	char path[64];
+	int i, ret = 1;
+
+	if (mkdtemp(root) == NULL)
+		return 1;
+
+	if (write_file("class/hidraw/hidraw0/device/uevent",
+		       "DRIVER=hid-generic\nHID_ID=0003:0000046D:0000C52B\nHID_NAME=Logitech\nHID_UNIQ=\n") ||
+	    write_file("class/hidraw/hidraw3/device/uevent",
+		       "DRIVER=hid-generic\nHID_ID=0003:000005F3:000002B1\nHID_NAME=P. I. Engineering\nHID_UNIQ=1234\n") ||
+	    write_file("class/input/event2/device/id/bustype", "0003\n") ||
+	    write_file("class/input/event2/device/id/vendor", "05f3\n") ||
+	    write_file("class/input/event2/device/id/product", "02b1\n") ||
+	    write_file("class/input/event7/device/id/bustype", "0006\n") ||
+	    write_file("class/input/event7/device/id/vendor", "05f3\n") ||
+	    write_file("class/input/event7/device/id/product", "02b1\n") ||
+	    write_file("class/input/mouse0/dev", "13:32\n"))
+		goto out;
+	/* more input devices than the arrays start with */
+	for (i = 10; i < 110; i++) {
+		snprintf(path, sizeof(path), "class/input/event%i/device/id/bustype", i);
+		if (write_file(path, "0003\n"))
+			goto out;
+		snprintf(path, sizeof(path), "class/input/event%i/device/id/vendor", i);
+		if (write_file(path, "046d\n"))
+			goto out;
+		snprintf(path, sizeof(path), "class/input/event%i/device/id/product", i);
+		if (write_file(path, "c52b\n"))
+			goto out;
+	}
+
+	if (sysfs_scan(root, &index)) {
+		printf("scan failed\n");
+		goto out;
+	}
+	if (index.nhidraw != 2 || index.nevent != 102) {
+		printf("found %i hidraw and %i event nodes\n", index.nhidraw,
+		       index.nevent);
+		goto out;
+	}
+	for (i = 0; i < index.nhidraw; i++) {
+		if (index.hidraw[i].num != 3)
+			continue;
+		if (index.hidraw[i].bus != 3 || index.hidraw[i].vendor != 0x5f3 ||
+		    index.hidraw[i].product != 0x2b1 ||
+		    strcmp(index.hidraw[i].serial, "1234")) {
+			printf("wrong hidraw3 information\n");
+			goto out;
+		}
+		ret = 0;
+	}
+	for (i = 0; i < index.nevent; i++)
+		if (index.event[i].num == 7 && index.event[i].bus != 6) {
+			printf("wrong event7 information\n");
+			ret = 1;
+		}
+	if (ret)
+		goto out;
+
+	/*
+	 * what a reload finds after hotplug: hidraw0 is gone, hidraw3 now
+	 * belongs to another device and the X-keys came back as hidraw5
+	 */
+	ret = 1;
+	snprintf(path, sizeof(path), "%s/class/hidraw/hidraw0", root);
+	if (nftw(path, remove_file, 16, FTW_DEPTH | FTW_PHYS) ||
+	    write_file("class/hidraw/hidraw3/device/uevent",
+		       "DRIVER=hid-generic\nHID_ID=0003:0000046D:0000C077\nHID_NAME=Logitech\nHID_UNIQ=\n") ||
+	    write_file("class/hidraw/hidraw5/device/uevent",
+		       "DRIVER=hid-generic\nHID_ID=0003:000005F3:000002B1\nHID_NAME=P. I. Engineering\nHID_UNIQ=1234\n"))
+		goto out;
+	if (sysfs_scan(root, &index)) {
+		printf("rescan failed\n");
+		goto out;
+	}
+	if (index.nhidraw != 2) {
+		printf("rescan found %i hidraw nodes\n", index.nhidraw);
+		goto out;
+	}
+	for (i = 0; i < index.nhidraw; i++) {
+		if (index.hidraw[i].num == 3 && index.hidraw[i].vendor != 0x46d) {
+			printf("stale hidraw3 information after the rescan\n");
+			ret = 1;
+			goto out;
+		}
+		if (index.hidraw[i].num == 5 &&
+		    index.hidraw[i].product == 0x2b1 &&
+		    !strcmp(index.hidraw[i].serial, "1234"))
+			ret = 0;
+	}
+	if (ret)
+		printf("hidraw5 missing after the rescan\n");
+	if (!ret)
+		printf("sysfs discovery ok\n");
+out:
+	sysfs_free(&index);
+	nftw(root, remove_file, 16, FTW_DEPTH | FTW_PHYS);
+	return ret;
+}
@@ -0,0 +1,279 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/timerfd.h>
+
+#include "log.h"
+#include "loop.h"
+#include "timer.h"
+
+#define LEVEL_MASK	(TIMER_LEVEL_SIZE - 1)
+/* the furthest a timer can be, later ones are cut down to it */
+#define MAX_TICKS	((1ULL << (TIMER_LEVELS * TIMER_LEVEL_BITS)) - 1)
+
+static struct {
+	struct timer *slots[TIMER_LEVELS][TIMER_LEVEL_SIZE];
+	uint64_t used[TIMER_LEVELS];	/* bitmap of the slots not empty */
+	uint64_t clk;			/* next tick to be run */
+	uint64_t base;			/* monotonic time of tick 0 */
+	uint64_t armed;			/* tick the timerfd is set for, 0 if none */
+	uint64_t now;			/* while running them */
+	int fd;
+	int running;
+	struct loop_source source;
+} wheel = { .fd = -1 };
+
+static uint64_t now_ticks(void)
+{
+	return (monotonic_ns() - wheel.base) / TIMER_TICK_NS;
+}
+
+/*
+ * level 0 holds the timers of the next TIMER_LEVEL_SIZE ticks, one slot
+ * per tick. each level up covers TIMER_LEVEL_SIZE times more with the same
+ * number of slots, and its timers are moved down a level (cascaded) when
+ * the level below wraps around
+ */
+static void enqueue(struct timer *timer)
+{
+	uint64_t expires = timer->expires, delta;
+	int level, slot;
+
+	if (expires < wheel.clk)
+		expires = timer->expires = wheel.clk;
+	delta = expires - wheel.clk;
+	if (delta > MAX_TICKS)
+		expires = timer->expires = wheel.clk + MAX_TICKS;
+
+	for (level = 0; level < TIMER_LEVELS - 1; level++)
+		if (delta < 1ULL << ((level + 1) * TIMER_LEVEL_BITS))
+			break;
+	slot = (expires >> (level * TIMER_LEVEL_BITS)) & LEVEL_MASK;
+
+	timer->next = wheel.slots[level][slot];
+	if (timer->next)
+		timer->next->pprev = &timer->next;
+	timer->pprev = &wheel.slots[level][slot];
+	wheel.slots[level][slot] = timer;
+	wheel.used[level] |= 1ULL << slot;
+}
+
+/*
+ * takes the whole list of a slot out of the wheel. the first timer points
+ * back to the caller's list, so timers can still be deleted from it
+ */
+static void take_slot(int level, int slot, struct timer **list)
+{
+	*list = wheel.slots[level][slot];
+	wheel.slots[level][slot] = NULL;
+	wheel.used[level] &= ~(1ULL << slot);
+	if (*list)
+		(*list)->pprev = list;
+}
+
+static void unlink_timer(struct timer *timer)
+{
+	*timer->pprev = timer->next;
+	if (timer->next)
+		timer->next->pprev = timer->pprev;
+	timer->pprev = NULL;
+}
+
+/* moves the timers of the slot coming up at a level to the levels below */
+static void cascade(int level)
+{
+	struct timer *list, *timer;
+
+	take_slot(level, (wheel.clk >> (level * TIMER_LEVEL_BITS)) & LEVEL_MASK,
+		  &list);
+	while ((timer = list) != NULL) {
+		unlink_timer(timer);
+		enqueue(timer);
+	}
+}
+
+static inline uint64_t rotate_right(uint64_t x, int n)
+{
+	return n ? (x >> n) | (x << (64 - n)) : x;
+}
+
+/*
+ * the next tick with something to do: a timer expiring in level 0, or a
+ * slot of an upper level cascading down. found from the bitmaps of used
+ * slots, without looking at the timers
+ */
+static uint64_t next_tick(void)
+{
+	uint64_t next = 0, tick, block;
+	int level, shift, index, skip;
+
+	for (level = 0; level < TIMER_LEVELS; level++) {
+		if (!wheel.used[level])
+			continue;
+		shift = level * TIMER_LEVEL_BITS;
+		block = wheel.clk >> shift;
+		index = block & LEVEL_MASK;
+		/* the current slot already cascaded, unless that's due now */
+		skip = (wheel.clk & ((1ULL << shift) - 1)) != 0;
+		tick = (block + skip +
+			__builtin_ctzll(rotate_right(wheel.used[level],
+						     (index + skip) & LEVEL_MASK))) << shift;
+		if (next == 0 || tick < next)
+			next = tick;
+	}
+	return next;
+}
+
+static int arm(void)
+{
+	struct itimerspec its;
+	uint64_t next = next_tick(), when;
+
+	if (next == wheel.armed)
+		return 0;
+	/* a zero value disarms it */
+	memset(&its, 0, sizeof(its));
+	if (next) {
+		when = wheel.base + next * TIMER_TICK_NS;
+		its.it_value.tv_sec = when / 1000000000ULL;
+		its.it_value.tv_nsec = when % 1000000000ULL;
+	}
+	if (timerfd_settime(wheel.fd, TFD_TIMER_ABSTIME, &its, NULL)) {
+		log_err("Error arming timer (%s)\n", strerror(errno));
+		return 1;
+	}
+	wheel.armed = next;
+	return 0;
+}
+
+/*
+ * runs every tick up to now. idle ticks are skipped, only the ones with
+ * timers expiring or a cascade due are visited
+ */
+static int run_timers(void)
+{
+	struct timer *list, *timer;
+	uint64_t next;
+	int level, ret = 0;
+
+	wheel.now = now_ticks();
+	wheel.running = 1;
+	while (!ret) {
+		next = next_tick();
+		if (next == 0 || next > wheel.now) {
+			/* nothing to do until then, catch up at once */
+			wheel.clk = wheel.now + 1;
+			break;
+		}
+		wheel.clk = next;
+
+		/* the upper levels wrapping around cascade, top down */
+		for (level = 1; level < TIMER_LEVELS; level++)
+			if (wheel.clk & ((1ULL << (level * TIMER_LEVEL_BITS)) - 1))
+				break;
+		while (--level > 0)
+			cascade(level);
+
+		take_slot(0, wheel.clk & LEVEL_MASK, &list);
+		wheel.clk++;
+		while (!ret && (timer = list) != NULL) {
+			unlink_timer(timer);
+			ret = timer->fn(timer);
+		}
+		/* on error, the rest are put back for the next run */
+		while ((timer = list) != NULL) {
+			unlink_timer(timer);
+			enqueue(timer);
+		}
+	}
+	wheel.running = 0;
+	if (arm())
+		ret = 1;
+	return ret;
+}
+
+static int timer_input(struct loop_source *source)
+{
+	uint64_t expirations;
+
+	if (read(wheel.fd, &expirations, sizeof(expirations)) < 0 &&
+	    errno != EAGAIN) {
+		log_err("Error reading timer (%s)\n", strerror(errno));
+		return 1;
+	}
+	wheel.armed = 0;
+	return run_timers();
+}
+
+int timers_enabled(void)
+{
+	return wheel.fd >= 0;
+}
+
+/*
+ * (re)starts the timer to expire in 'ms'. returns 1 if there are no
+ * timers, like when not running the main loop
+ */
+int timer_add(struct timer *timer, unsigned int ms)
+{
+	int level;
+
+	if (wheel.fd < 0)
+		return 1;
+	if (timer_pending(timer))
+		unlink_timer(timer);
+	if (wheel.running) {
+		/* the timerfd is armed once they're all done */
+		timer->expires = wheel.now + ms;
+		enqueue(timer);
+		return 0;
+	}
+
+	for (level = 0; level < TIMER_LEVELS; level++)
+		if (wheel.used[level])
+			break;
+	timer->expires = now_ticks() + ms;
+	/* an empty wheel has nothing to catch up on */
+	if (level == TIMER_LEVELS)
+		wheel.clk = timer->expires - ms;
+	enqueue(timer);
+	return arm();
+}
+
+void timer_del(struct timer *timer)
+{
+	if (timer_pending(timer))
+		unlink_timer(timer);
+}
+
+int timers_init(void)
+{
+	wheel.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (wheel.fd < 0) {
+		log_err("Error creating timer (%s)\n", strerror(errno));
+		return 1;
+	}
+	/* tick 0 is left out, a next tick of 0 means there's none */
+	wheel.base = monotonic_ns() - TIMER_TICK_NS;
+	wheel.clk = 1;
+	wheel.source.handler = timer_input;
+	return loop_add(wheel.fd, &wheel.source);
+}
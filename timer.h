@@ -0,0 +1,58 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef TIMER_H
+#define TIMER_H
+#include <stdint.h>
+
+/*
+ * timers of the daemon: macro delays and key repeat. they live in a
+ * hierarchical timing wheel with a 1ms tick, so adding, removing and
+ * expiring a timer is O(1) no matter how many are pending. the wheel is
+ * driven by a single timerfd in the main loop, armed for the next tick
+ * that has something to do
+ */
+#define TIMER_TICK_NS		1000000ULL
+#define TIMER_LEVEL_BITS	6
+#define TIMER_LEVEL_SIZE	(1 << TIMER_LEVEL_BITS)
+#define TIMER_LEVELS		4
+
+struct timer {
+	struct timer *next;
+	struct timer **pprev;		/* NULL if not pending */
+	uint64_t expires;		/* in ticks */
+	/* returning non zero stops the main loop */
+	int (*fn)(struct timer *timer);
+};
+
+static inline void timer_setup(struct timer *timer,
+			       int (*fn)(struct timer *timer))
+{
+	timer->pprev = NULL;
+	timer->fn = fn;
+}
+
+static inline int timer_pending(const struct timer *timer)
+{
+	return timer->pprev != NULL;
+}
+
+int timers_init(void);
+int timers_enabled(void);
+int timer_add(struct timer *timer, unsigned int ms);
+void timer_del(struct timer *timer);
+#endif	/* TIMER_H */
@@ -0,0 +1,654 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <linux/io_uring.h>
+
+#include "log.h"
+#include "device.h"
+#include "loop.h"
+#include "uring.h"
+
+#define URING_ENTRIES	256
+/* buffers for writes in flight, each holds a few output batches */
+#define URING_WRITES	32
+#define URING_WRITE_EVENTS	(4 * OUTPUT_BATCH_SIZE)
+/* rounds of completions handled before going back to the main loop */
+#define URING_ROUNDS	16
+
+/* user_data of writes has the lowest bit set, others are a request */
+#define URING_WRITE_TAG	1UL
+
+/* a batch whose latency is taken when the write with its events completes */
+struct uring_sample {
+	struct device *dev;
+	uint64_t start;
+	int classes;
+};
+
+struct uring_write {
+	struct input_event ev[URING_WRITE_EVENTS];
+	unsigned int count;
+	int fd;
+	int busy;		/* queued or in flight */
+	struct uring_write *next;
+	struct uring_sample samples[URING_WRITE_EVENTS];
+	unsigned int nsamples;
+};
+
+static struct {
+	int fd;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size;
+	unsigned int sq_entries;
+	unsigned int tail;		/* local copy of the sq tail */
+	unsigned int to_submit;
+} ring = { .fd = -1 };
+
+static struct uring_write writes[URING_WRITES];
+static struct uring_write *free_writes;
+/* queued in order, they're submitted linked so uinput gets them in order */
+static struct uring_write *pending_writes[URING_WRITES];
+static int npending_writes;
+static int writes_in_flight;
+/* the last write submitted, the others in flight are ahead of it */
+static struct uring_write *last_write;
+/* writes queued from elsewhere, like timers, are submitted right away */
+static int processing;
+
+/* devices with completions, handled on the next round */
+static struct uring_slot *ready;
+
+/* requests to post on the next submission, in order */
+static struct uring_req *post_head, **post_tail = &post_head;
+
+static struct loop_source uring_source;
+
+unsigned long uring_enters;
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(unsigned int to_submit, unsigned int min_complete,
+			      unsigned int flags)
+{
+	uring_enters++;
+	return syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+static unsigned int sq_space(void)
+{
+	unsigned int head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+
+	return ring.sq_entries - (ring.tail - head);
+}
+
+static struct io_uring_sqe *get_sqe(void)
+{
+	unsigned int index;
+	struct io_uring_sqe *sqe;
+
+	if (sq_space() == 0)
+		return NULL;
+	index = ring.tail & *ring.sq_mask;
+	sqe = &ring.sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	ring.sq_array[index] = index;
+	ring.tail++;
+	ring.to_submit++;
+	return sqe;
+}
+
+/* sends everything queued so far with a single io_uring_enter() */
+static int enter(unsigned int min_complete)
+{
+	unsigned int flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+	int ret;
+
+	__atomic_store_n(ring.sq_tail, ring.tail, __ATOMIC_RELEASE);
+	do {
+		ret = sys_io_uring_enter(ring.to_submit, min_complete, flags);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0) {
+		log_err("Error submitting to io_uring (%s)\n", strerror(errno));
+		return 1;
+	}
+	ring.to_submit -= ret;
+	return 0;
+}
+
+/* once the queue is full, what's in it goes to the kernel first */
+static struct io_uring_sqe *next_sqe(void)
+{
+	if (sq_space() == 0 && enter(0))
+		return NULL;
+	return get_sqe();
+}
+
+static int submit(void);
+static int reap(int reads);
+
+/*
+ * events for the same uinput device are added to the last write queued
+ * while there's room, the others take a buffer each, linked in order like
+ * the rest. out of buffers, the queued writes are submitted and the first
+ * of them to complete frees one: writing directly would get ahead of them
+ */
+static int uring_write(struct device *dev, const struct input_event *ev,
+		       unsigned int count)
+{
+	struct uring_write *w;
+	unsigned int n;
+
+	while (count) {
+		w = npending_writes ? pending_writes[npending_writes - 1] : NULL;
+		if (w == NULL || w->fd != dev->uinput ||
+		    w->count == URING_WRITE_EVENTS) {
+			while (free_writes == NULL)
+				if (submit() || (free_writes == NULL &&
+						 (enter(1) || reap(0))))
+					return 1;
+			w = free_writes;
+			free_writes = w->next;
+			w->count = 0;
+			w->nsamples = 0;
+			w->busy = 1;
+			w->fd = dev->uinput;
+			pending_writes[npending_writes++] = w;
+		}
+		n = URING_WRITE_EVENTS - w->count;
+		if (n > count)
+			n = count;
+		memcpy(&w->ev[w->count], ev, n * sizeof(*ev));
+		w->count += n;
+		ev += n;
+		count -= n;
+	}
+	if (!processing)
+		return submit();
+	return 0;
+}
+
+/*
+ * the latency of a batch goes with the last write of its device, queued or
+ * in flight, so it's taken from the same point as with write(). a batch
+ * that has none left is taken now
+ */
+static void uring_account(struct device *dev, int classes, uint64_t start)
+{
+	struct uring_write *w;
+	struct uring_sample *sample;
+
+	w = npending_writes ? pending_writes[npending_writes - 1] : last_write;
+	if (w == NULL || !w->busy || w->fd != dev->uinput ||
+	    w->nsamples == URING_WRITE_EVENTS) {
+		device_account(dev, classes, start);
+		return;
+	}
+	sample = &w->samples[w->nsamples++];
+	sample->dev = dev;
+	sample->start = start;
+	sample->classes = classes;
+}
+
+static void post(struct uring_req *req)
+{
+	req->posted = 1;
+	req->next = NULL;
+	*post_tail = req;
+	post_tail = &req->next;
+	req->slot->posted++;
+}
+
+static void post_reads(struct uring_slot *slot, unsigned int batch)
+{
+	unsigned int i;
+
+	slot->batch = batch;
+	slot->head = 0;
+	for (i = 0; i < batch; i++)
+		post(&slot->reads[i]);
+}
+
+/*
+ * the writes of the previous submission have to complete before the next
+ * ones go, as io_uring may run writes to uinput from its workers and only
+ * linked requests keep their order. the wait is short, uinput doesn't block
+ */
+static int submit(void)
+{
+	struct io_uring_sqe *sqe;
+	struct uring_write *w;
+	struct uring_req *req;
+	int i;
+
+	while (npending_writes && writes_in_flight) {
+		if (enter(1) || reap(0))
+			return 1;
+	}
+
+	/* a chain cut by a full queue would lose its order */
+	if (sq_space() < npending_writes && enter(0))
+		return 1;
+	for (i = 0; i < npending_writes; i++) {
+		w = pending_writes[i];
+		sqe = get_sqe();
+		if (sqe == NULL)
+			return 1;
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->fd = w->fd;
+		sqe->addr = (unsigned long)w->ev;
+		sqe->len = w->count * sizeof(struct input_event);
+		sqe->off = -1;
+		sqe->user_data = (unsigned long)w | URING_WRITE_TAG;
+		if (i != npending_writes - 1)
+			sqe->flags = IOSQE_IO_LINK;
+	}
+	if (npending_writes)
+		last_write = pending_writes[npending_writes - 1];
+	writes_in_flight += npending_writes;
+	npending_writes = 0;
+
+	while ((req = post_head) != NULL) {
+		sqe = next_sqe();
+		if (sqe == NULL)
+			return 1;
+		sqe->fd = req->slot->dev->fd;
+		sqe->user_data = (unsigned long)req;
+		if (req->buf) {
+			sqe->opcode = IORING_OP_READ;
+			sqe->addr = (unsigned long)req->buf;
+			sqe->len = device_read_size(req->slot->dev);
+			sqe->off = -1;
+			if (req->slot->nowait)
+				sqe->rw_flags = RWF_NOWAIT;
+		} else {
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->poll32_events = POLLIN;
+		}
+		post_head = req->next;
+	}
+	post_tail = &post_head;
+
+	/* a completion wakes up the main loop for the reads put aside */
+	if (!processing && ready && (sqe = next_sqe()) != NULL)
+		sqe->opcode = IORING_OP_NOP;
+
+	if (ring.to_submit == 0)
+		return 0;
+	return enter(0);
+}
+
+static void req_complete(struct uring_req *req, int res)
+{
+	struct uring_slot *slot = req->slot;
+
+	req->posted = 0;
+	slot->posted--;
+	if (slot->dev == NULL) {
+		/* detached while the request was in flight */
+		if (!slot->posted && !slot->queued)
+			free(slot);
+		return;
+	}
+	req->res = res;
+	req->done = 1;
+	if (!slot->queued) {
+		slot->queued = 1;
+		slot->next = ready;
+		ready = slot;
+	}
+}
+
+/*
+ * reads left waiting on a device would be handed its reports in no
+ * particular order, so they're only posted once it's readable and handled
+ * in the order they were posted. the events of the whole drain are written
+ * at once, so motion is summed up like with device_input().
+ *
+ * io_uring ignores O_NONBLOCK and waits anyway on files that can do non
+ * blocking I/O themselves, RWF_NOWAIT is what stops it there. the others,
+ * like hidraw and evdev, refuse RWF_NOWAIT but go by O_NONBLOCK
+ */
+static int read_done(struct uring_slot *slot, uint64_t start)
+{
+	struct device *dev = slot->dev;
+	struct uring_req *req;
+	unsigned int left;
+	int res, ret = 0;
+
+	if (slot->poll.done) {
+		slot->poll.done = 0;
+		res = slot->poll.res;
+		if (res < 0)
+			goto err;
+		slot->reports = 0;
+		slot->drained = 0;
+		post_reads(slot, URING_FIRST_BATCH);
+		return 0;
+	}
+	while (!ret && slot->head < slot->batch &&
+	       (req = &slot->reads[slot->head])->done) {
+		req->done = 0;
+		slot->head++;
+		res = req->res;
+		if (res == -EOPNOTSUPP && slot->nowait) {
+			/* read again without it */
+			slot->nowait = 0;
+			continue;
+		}
+		if (res == -EAGAIN) {
+			slot->drained = 1;
+			continue;
+		}
+		if (res <= 0)
+			goto err;
+		slot->reports++;
+		ret = device_process(dev, req->buf, res, start);
+	}
+	if (ret || slot->head < slot->batch)
+		return ret;
+
+	left = DEVICE_DRAIN_READS - slot->reports;
+	if (!slot->drained && left) {
+		post_reads(slot, slot->batch * 2 < left ? slot->batch * 2 : left);
+		return 0;
+	}
+	post(&slot->poll);
+	return device_flush(dev);
+err:
+	log_err("Error reading from device \"%s\" (%s), detaching it\n",
+		dev->name, strerror(res ? -res : ENODEV));
+	device_flush(dev);
+	device_detach(dev);
+	return 0;
+}
+
+/*
+ * the head is moved past each completion before handling it, as detaching
+ * a device from a handler may wait for completions itself. while waiting
+ * on writes, completions are only put aside: the events of a device may
+ * be in the middle of being written
+ */
+static int reap(int reads)
+{
+	struct io_uring_cqe *cqe;
+	struct uring_slot *slot;
+	struct uring_sample *sample;
+	struct uring_write *w;
+	unsigned int head;
+	uint64_t start = monotonic_ns();
+	uint64_t user_data;
+	int res, ret = 0;
+
+	for (;;) {
+		head = *ring.cq_head;
+		if (head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE))
+			break;
+		cqe = &ring.cqes[head & *ring.cq_mask];
+		user_data = cqe->user_data;
+		res = cqe->res;
+		__atomic_store_n(ring.cq_head, head + 1, __ATOMIC_RELEASE);
+
+		if (user_data & URING_WRITE_TAG) {
+			w = (struct uring_write *)(user_data & ~URING_WRITE_TAG);
+			if (res != w->count * sizeof(struct input_event))
+				log_err("Error writing events to uinput device (%s)\n",
+					strerror(res < 0 ? -res : EIO));
+			else
+				for (sample = w->samples;
+				     sample < &w->samples[w->nsamples]; sample++)
+					device_account(sample->dev,
+						       sample->classes,
+						       sample->start);
+			w->busy = 0;
+			w->next = free_writes;
+			free_writes = w;
+			writes_in_flight--;
+		} else if (user_data)
+			req_complete((struct uring_req *)user_data, res);
+		/* user_data 0 is a cancel request or a nop, nothing to do */
+	}
+
+	while (reads && ready && !ret) {
+		slot = ready;
+		ready = slot->next;
+		slot->queued = 0;
+		if (slot->dev)
+			ret = read_done(slot, start);
+		else if (!slot->posted)
+			free(slot);
+	}
+	return ret;
+}
+
+static int cq_ready(void)
+{
+	return ready ||
+	       *ring.cq_head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * handles the completions and submits what they produced. reads of data
+ * already queued complete while being submitted, so a busy device is
+ * handled here without going back to the main loop
+ */
+int uring_process(void)
+{
+	int i, ret = 0;
+
+	processing = 1;
+	for (i = 0; i < URING_ROUNDS && !ret; i++) {
+		ret = reap(1) || submit();
+		if (!cq_ready())
+			break;
+	}
+	processing = 0;
+	return ret;
+}
+
+/* blocks until something completes, for callers not using the main loop */
+int uring_wait(void)
+{
+	if (!cq_ready() && enter(1))
+		return 1;
+	return uring_process();
+}
+
+/* returns once everything queued for uinput so far has been written */
+int uring_sync(void)
+{
+	if (submit())
+		return 1;
+	while (writes_in_flight)
+		if (enter(1) || reap(0))
+			return 1;
+	return 0;
+}
+
+static int uring_input(struct loop_source *source)
+{
+	return uring_process();
+}
+
+int uring_enabled(void)
+{
+	return ring.fd >= 0;
+}
+
+int uring_attach(struct device *dev)
+{
+	struct uring_slot *slot;
+	int size = device_read_size(dev);
+	int i;
+
+	slot = calloc(1, sizeof(*slot) + DEVICE_DRAIN_READS * size);
+	if (slot == NULL) {
+		log_err("Not enough memory\n");
+		return 1;
+	}
+	slot->dev = dev;
+	slot->nowait = 1;
+	slot->poll.slot = slot;
+	for (i = 0; i < DEVICE_DRAIN_READS; i++) {
+		slot->reads[i].slot = slot;
+		slot->reads[i].buf = (unsigned char *)(slot + 1) + i * size;
+	}
+	dev->uring = slot;
+	dev->out.write = uring_write;
+	dev->out.account = uring_account;
+	post(&slot->poll);
+	return submit();
+}
+
+static void cancel(struct uring_req *req)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!req->posted)
+		return;
+	sqe = next_sqe();
+	if (sqe) {
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = (unsigned long)req;
+	}
+}
+
+/*
+ * the requests in flight are cancelled and the slot freed once they all
+ * completed. the events queued so far are written before the device's
+ * uinput goes away
+ */
+void uring_detach(struct device *dev)
+{
+	struct uring_slot *slot = dev->uring;
+	struct uring_req **p, *req;
+	int i;
+
+	dev->uring = NULL;
+	dev->out.write = NULL;
+	dev->out.account = NULL;
+	slot->dev = NULL;
+	/* what wasn't submitted yet is just dropped */
+	for (p = &post_head; (req = *p) != NULL; ) {
+		if (req->slot != slot) {
+			p = &req->next;
+			continue;
+		}
+		*p = req->next;
+		req->posted = 0;
+		slot->posted--;
+	}
+	post_tail = p;
+	cancel(&slot->poll);
+	for (i = 0; i < DEVICE_DRAIN_READS; i++)
+		cancel(&slot->reads[i]);
+	if (!slot->posted && !slot->queued)
+		free(slot);
+
+	uring_sync();
+}
+
+/* returns 1 if io_uring is not available, the read/write path is used then */
+int uring_init(void)
+{
+	struct io_uring_params p;
+	int i;
+
+	memset(&p, 0, sizeof(p));
+	ring.fd = sys_io_uring_setup(URING_ENTRIES, &p);
+	if (ring.fd < 0) {
+		log_err("io_uring not available (%s)\n", strerror(errno));
+		return 1;
+	}
+
+	ring.sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring.cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring.cq_ring_size > ring.sq_ring_size)
+			ring.sq_ring_size = ring.cq_ring_size;
+		ring.cq_ring_size = ring.sq_ring_size;
+	}
+	ring.sq_ring = mmap(NULL, ring.sq_ring_size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+	if (ring.sq_ring == MAP_FAILED)
+		goto err_close;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring.cq_ring = ring.sq_ring;
+	else {
+		ring.cq_ring = mmap(NULL, ring.cq_ring_size, PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_POPULATE, ring.fd,
+				    IORING_OFF_CQ_RING);
+		if (ring.cq_ring == MAP_FAILED)
+			goto err_sq;
+	}
+	ring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+			 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			 ring.fd, IORING_OFF_SQES);
+	if (ring.sqes == MAP_FAILED)
+		goto err_cq;
+
+	ring.sq_head = ring.sq_ring + p.sq_off.head;
+	ring.sq_tail = ring.sq_ring + p.sq_off.tail;
+	ring.sq_mask = ring.sq_ring + p.sq_off.ring_mask;
+	ring.sq_array = ring.sq_ring + p.sq_off.array;
+	ring.sq_entries = p.sq_entries;
+	ring.tail = *ring.sq_tail;
+	ring.cq_head = ring.cq_ring + p.cq_off.head;
+	ring.cq_tail = ring.cq_ring + p.cq_off.tail;
+	ring.cq_mask = ring.cq_ring + p.cq_off.ring_mask;
+	ring.cqes = ring.cq_ring + p.cq_off.cqes;
+
+	for (i = 0; i < URING_WRITES; i++) {
+		writes[i].next = free_writes;
+		free_writes = &writes[i];
+	}
+
+	/* the ring becomes readable when there are completions */
+	uring_source.handler = uring_input;
+	if (loop_add(ring.fd, &uring_source))
+		goto err_sqes;
+	return 0;
+err_sqes:
+	free_writes = NULL;
+	munmap(ring.sqes, p.sq_entries * sizeof(struct io_uring_sqe));
+err_cq:
+	if (ring.cq_ring != ring.sq_ring)
+		munmap(ring.cq_ring, ring.cq_ring_size);
+err_sq:
+	munmap(ring.sq_ring, ring.sq_ring_size);
+err_close:
+	log_err("Error setting up io_uring (%s)\n", strerror(errno));
+	close(ring.fd);
+	ring.fd = -1;
+	return 1;
+}
@@ -0,0 +1,67 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef URING_H
+#define URING_H
+#include "device.h"
+
+/*
+ * optional io_uring backend: a poll is kept posted for every device and
+ * once it's readable, it's drained like device_input() does, up to
+ * DEVICE_DRAIN_READS reports. the reads are posted in batches, twice as
+ * big each time, that don't wait for reports: they complete right away
+ * and in order, until there's nothing left to read. the events for uinput
+ * are queued as writes, so a whole batch of reports from all devices costs
+ * a single io_uring_enter(). talks to the kernel directly, without liburing
+ */
+#define URING_FIRST_BATCH	2
+struct uring_slot;
+struct uring_req {
+	struct uring_slot *slot;
+	struct uring_req *next;		/* in the list of requests to post */
+	int posted;		/* about to be posted or in flight */
+	int done;		/* completed, waiting to be handled */
+	int res;
+	void *buf;		/* NULL for the poll */
+};
+
+struct uring_slot {
+	struct device *dev;	/* NULL once detached */
+	int posted;		/* requests posted, freed once there are none */
+	int queued;		/* in the list of slots with completions */
+	int drained;		/* a read of the batch found nothing */
+	int nowait;		/* the device takes RWF_NOWAIT */
+	struct uring_slot *next;
+	unsigned int batch;	/* reads in the batch */
+	unsigned int head;	/* the read to handle next */
+	unsigned int reports;	/* read since the device became readable */
+	struct uring_req poll;
+	struct uring_req reads[DEVICE_DRAIN_READS];
+	/* the read buffers follow */
+};
+
+/* statistics */
+extern unsigned long uring_enters;
+
+int uring_init(void);
+int uring_enabled(void);
+int uring_attach(struct device *dev);
+void uring_detach(struct device *dev);
+int uring_process(void);
+int uring_wait(void);
+int uring_sync(void);
+#endif	/* URING_H */
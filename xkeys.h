@@ -0,0 +1,107 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef XKEYS_H
+#define XKEYS_H
+#include <stdint.h>
+
+#define XKEYS_VENDOR	0x5f3
+/* the Jog & Shuttle, used when the model can't be told */
+#define XKEYS_PRODUCT	0x2b1
+
+/* enough for the biggest model, the XK-128 */
+#define XKEYS_MAX_KEYS		128
+#define XKEYS_KEY_WORDS		(XKEYS_MAX_KEYS / 64)
+#define XKEYS_MAX_KEY_BYTES	16
+/* large enough for a whole report of any model */
+#define XKEYS_READ_SIZE		32
+
+struct xkeys_key_byte {
+	unsigned char mask;
+	unsigned char shift;
+};
+
+/*
+ * report layout of a model. key bytes carry one column each, starting from
+ * bit 0, so the keys of a byte are consecutive. packing them into words is
+ * a mask and a shift per byte, and leaves key N on bit N % 64 of word N / 64.
+ * no byte crosses a word boundary
+ */
+struct xkeys_model {
+	const char *name;
+	uint16_t product;
+	unsigned char nkeys;
+	unsigned char report_size;	/* bytes needed to decode a report */
+	unsigned char type_offset;	/* report type byte, 0 if not checked */
+	unsigned char type;
+	signed char shuttle;		/* dial offsets, -1 if there's none */
+	signed char jog;
+	unsigned char keys;		/* first key byte */
+	unsigned char nkey_bytes;
+	struct xkeys_key_byte key_bytes[XKEYS_MAX_KEY_BYTES];
+};
+
+#define XKEYS_WORDS(nkeys)	(((nkeys) + 63) / 64)
+
+/*
+ * Jog & Shuttle key numbering, as seen from the top of the device:
+ *
+ *  0   7  14  18  22  26  30  37  44
+ *  1   8  15  19  23  27  31  38  45
+ *
+ *  2   9   16  20  24  28  32  39
+ *  3  10   17  21  25  29  33  40
+ *  4  11                   34  41
+ *  5  12                   35  42
+ *  6  13                   36  43
+ *
+ * the other models number their keys column by column too, so key N is on
+ * row N % rows of column N / rows
+ */
+
+/*
+ * always inlined, so with a model known at compile time the whole loop
+ * folds into a fixed sequence of masks and shifts
+ */
+static inline __attribute__((always_inline))
+void xkeys_pack_keys(const struct xkeys_model *model,
+		     const unsigned char *report, uint64_t *keys)
+{
+	const struct xkeys_key_byte *kb;
+	int i;
+
+	for (i = 0; i < XKEYS_WORDS(model->nkeys); i++)
+		keys[i] = 0;
+#pragma GCC unroll 16	/* XKEYS_MAX_KEY_BYTES */
+	for (i = 0; i < model->nkey_bytes; i++) {
+		kb = &model->key_bytes[i];
+		keys[kb->shift / 64] |= (uint64_t)(report[model->keys + i] &
+						    kb->mask) << (kb->shift % 64);
+	}
+}
+
+const struct xkeys_model *xkeys_model_find(uint16_t product);
+
+/*
+ * iterate over the keys that changed between two packed states. each
+ * iteration only visits a changed key, not all of them
+ */
+#define for_each_changed_key(key, changed) \
+	for (; (changed) && ((key) = __builtin_ctzll(changed), 1); \
+	     (changed) &= (changed) - 1)
+
+#endif	/* XKEYS_H */
@@ -0,0 +1,173 @@
+/*
+ *    This file is part of xkeysd.
+ *
+ *    xkeysd is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    xkeysd is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with xkeysd; if not, write to the Free Software
+ *    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+/*
+ * client for the control socket of xkeysd: the arguments are sent as a
+ * single request and the output of the command is printed. 'watch' reads
+ * an event ring instead, as an example of a ring reader
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "control.h"
+#include "ring.h"
+
+static void help(void)
+{
+	printf("xkeysctl [-s socket] <command> [arguments]\n");
+	printf("\t-s <socket>\tcontrol socket of xkeysd (default %s)\n", CONTROL_FILE);
+	printf("commands:\n");
+	printf("\tlist\t\t\t\t\tdevices, their state and layers\n");
+	printf("\tlayer <device> <layer>\t\t\tswitch to a layer, by name or number\n");
+	printf("\tkey <device> <key> press|release|tap\tinject a key change\n");
+	printf("\tdial <device> idial|edial <motion>\tinject dial motion\n");
+	printf("\tstats [device]\t\t\t\tevent counters and latencies\n");
+	printf("\treload\t\t\t\t\treread the configuration file\n");
+	printf("\twatch <ring>\t\t\t\tprint the events of a device's ring\n");
+	printf("devices go by position or name\n");
+}
+
+/* follows the ring from its current head, polling once a millisecond */
+static int watch(const char *name)
+{
+	static const struct timespec idle = { 0, 1000000 };
+	const struct ring_header *header;
+	struct ring_event ev;
+	struct stat st;
+	uint64_t pos;
+	int fd, ret;
+
+	fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0 || fstat(fd, &st)) {
+		fprintf(stderr, "Unable to open ring %s (%s)\n", name,
+			strerror(errno));
+		return 1;
+	}
+	header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED || st.st_size < sizeof(*header) ||
+	    memcmp(header->magic, RING_MAGIC, sizeof(header->magic)) ||
+	    header->version != RING_VERSION ||
+	    header->event_size != sizeof(struct ring_event) ||
+	    st.st_size < header->header_size +
+			 (uint64_t)header->size * header->event_size) {
+		fprintf(stderr, "%s is not an event ring\n", name);
+		return 1;
+	}
+
+	printf("device %u \"%.*s\", %u events\n", header->device,
+	       (int)sizeof(header->name), header->name, header->size);
+	fflush(stdout);
+	pos = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+	while (1) {
+		ret = ring_read(header, &pos, &ev);
+		if (ret == 0) {
+			nanosleep(&idle, NULL);
+			continue;
+		}
+		if (ret < 0) {
+			printf("events lost, skipping to %llu\n",
+			       (unsigned long long)pos);
+			continue;
+		}
+		printf("%llu.%09llu %s %u %i\n",
+		       (unsigned long long)(ev.timestamp / 1000000000ULL),
+		       (unsigned long long)(ev.timestamp % 1000000000ULL),
+		       ev.type == RING_EVENT_KEY ? "key" : "dial", ev.code,
+		       ev.value);
+		fflush(stdout);
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	char buf[CONTROL_MSG_SIZE], *body;
+	const char *path = CONTROL_FILE;
+	struct sockaddr_un addr;
+	int fd, i, len = 0;
+	ssize_t size;
+
+	if (argc > 2 && !strcmp(argv[1], "-s")) {
+		path = argv[2];
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc < 2 || !strcmp(argv[1], "-h")) {
+		help();
+		return argc < 2;
+	}
+	if (!strcmp(argv[1], "watch")) {
+		if (argc != 3) {
+			help();
+			return 1;
+		}
+		return watch(argv[2]);
+	}
+	for (i = 1; i < argc; i++) {
+		size = snprintf(buf + len, sizeof(buf) - len, "%s%s",
+				i > 1 ? " " : "", argv[i]);
+		if (size >= sizeof(buf) - len) {
+			fprintf(stderr, "Request too long\n");
+			return 1;
+		}
+		len += size;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		fprintf(stderr, "Unable to connect to %s (%s)\n", path,
+			strerror(errno));
+		if (errno == EACCES)
+			fprintf(stderr, "Other users need xkeysd started with --control-group\n");
+		return 1;
+	}
+	if (send(fd, buf, len, 0) != len) {
+		fprintf(stderr, "Error sending request (%s)\n", strerror(errno));
+		return 1;
+	}
+	size = recv(fd, buf, sizeof(buf) - 1, 0);
+	if (size <= 0) {
+		fprintf(stderr, "No reply from xkeysd (%s)\n",
+			size ? strerror(errno) : "connection closed");
+		return 1;
+	}
+	buf[size] = 0;
+	close(fd);
+
+	/* "ok" or "error", then the output */
+	body = strchr(buf, '\n');
+	body = body ? body + 1 : buf + size;
+	if (!strncmp(buf, "ok\n", 3)) {
+		fputs(body, stdout);
+		return 0;
+	}
+	fputs(body, stderr);
+	return 1;
+}
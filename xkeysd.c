@@ -22,8 +22,9 @@
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
-#include <glob.h>
 #include <syslog.h>
+#include <signal.h>
+#include <sys/signalfd.h>
 
 #include <libconfig.h>
 
@@ -32,28 +33,48 @@
 #include <linux/hidraw.h>
 
 #include "input.h"
-
-#define XKEYS_VENDOR	0x5f3
-#define XKEYS_PRODUCT	0x2b1
+#include "log.h"
+#include "device.h"
+#include "record.h"
+#include "loop.h"
+#include "hotplug.h"
+#include "sysfs.h"
+#include "cache.h"
+#include "uring.h"
+#include "timer.h"
+#include "control.h"
+
+#define SYSFS_ROOT "/sys"
 
 #ifndef UINPUT_FILE
 #error Please define UINPUT_FILE in Makefile
 #endif
 
+#ifndef CACHE_FILE
+#error Please define CACHE_FILE in Makefile
+#endif
+
 #define BITS_PER_LONG (sizeof(unsigned long) * 8)
 static unsigned long open_hidraw_devices[(HIDRAW_MAX_DEVICES/BITS_PER_LONG) + 1];
 static void set_ohd_bit(int num)
 {
 	int i = (num / BITS_PER_LONG);
 
-	open_hidraw_devices[i] |= (1 << num % BITS_PER_LONG);
+	open_hidraw_devices[i] |= (1UL << num % BITS_PER_LONG);
+}
+
+static void clear_ohd_bit(int num)
+{
+	int i = (num / BITS_PER_LONG);
+
+	open_hidraw_devices[i] &= ~(1UL << num % BITS_PER_LONG);
 }
 
 static int get_ohd_bit(int num)
 {
 	int i = (num / BITS_PER_LONG);
 
-	return (open_hidraw_devices[i] & (1 << num % BITS_PER_LONG));
+	return (open_hidraw_devices[i] & (1UL << num % BITS_PER_LONG));
 }
 
 int run_as_daemon;
@@ -62,94 +83,115 @@ static int log_init(void)
 {
 	if (run_as_daemon)
 		openlog("xkeysd", LOG_CONS, LOG_DAEMON);
+	return 0;
 }
 
-#define log(x...) do { \
-	if (run_as_daemon) \
-		syslog(LOG_DAEMON|LOG_NOTICE, #x); \
-	else \
-		printf(#x); \
-	} while(0)
+/* max number of event devices grabbed */
+#define EV_FDS_SIZE 10
+static struct {
+	int fd;
+	int num;	/* /dev/input/eventN */
+} grabbed[EV_FDS_SIZE];
+static int grabbed_count;
 
-#define log_err(x...) do { \
-	if (run_as_daemon) \
-		syslog(LOG_DAEMON|LOG_ERR, #x); \
-	else \
-		fprintf(stderr, #x); \
-	} while(0)
+static struct sysfs_index sysfs_index;
 
-static int find_devices(int *fds)
-{
-	int ret = 0, num, fd;
-	char filename[14];
-	struct hidraw_devinfo info;
+static struct device devices[HIDRAW_MAX_DEVICES];
+static int device_count;
 
-	for (num = 0; num < HIDRAW_MAX_DEVICES; num++) {
-		sprintf(filename, "/dev/hidraw%i", num);
-		fd = open(filename, O_RDWR);
-		if (fd < 0) {
-			log_err("Error opening %s: %s\n", filename,
-				strerror(errno));
-			return -1;
-		}
-		if (ioctl(fd, HIDIOCGRAWINFO, &info) < 0) {
-			log_err("Error retrieving device information (%s)\n", strerror(errno)); 
-			return -1;
-		}
-		if (info.vendor != XKEYS_VENDOR || info.product != XKEYS_PRODUCT) {
-			close(fd);
-			continue;
-		}
+/* X-keys and the other configured devices, but not our own uinput ones */
+static int should_grab(const struct sysfs_node *node)
+{
+	int i;
 
-		fds[ret++] = fd;
-	}
-	return ret;
+	if (node->bus == BUS_VIRTUAL)
+		return 0;
+	if (node->vendor == XKEYS_VENDOR && xkeys_model_find(node->product))
+		return 1;
+	for (i = 0; i < device_count; i++)
+		if (devices[i].mapping && devices[i].vendor == node->vendor &&
+		    devices[i].product == node->product)
+			return 1;
+	return 0;
 }
 
-static int grab_devices(int *ev_fds, int max)
+/*
+ * the devices also show up as regular keyboards, grab them so their own
+ * events don't reach anybody else
+ */
+static int grab_event_device(int num)
 {
-	glob_t buf; 
-	struct input_id id;
-	int i, fd, found = 0;
+	char filename[32];
+	int fd;
+
+	if (grabbed_count >= EV_FDS_SIZE) {
+		log_err("Max devices reached, ignoring others\n");
+		return 0;
+	}
 
-	if (glob("/dev/input/event*", 0, NULL, &buf))
+	snprintf(filename, sizeof(filename), "/dev/input/event%i", num);
+	fd = open(filename, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		log_err("Unable to open event device %s (%s)\n", filename,
+			strerror(errno));
 		return -1;
+	}
 
-	for (i = 0; i < buf.gl_pathc; i++) {
-		fd = open(buf.gl_pathv[i], O_RDWR);
-		if (fd < 0) {
-			log_err("Unable to open event device (%s)\n", strerror(errno));
-			return -1;
-		}
+	if (ioctl(fd, EVIOCGRAB, 1))
+		log_err("Unable to grab event device (%s)\n", strerror(errno));
+	grabbed[grabbed_count].fd = fd;
+	grabbed[grabbed_count].num = num;
+	grabbed_count++;
 
-		if (ioctl(fd, EVIOCGID, &id)) {
-			log_err("Unable to fetch information about event device (%s)\n", strerror(errno));
-			return -1;
-		}
+	return 0;
+}
 
-		if (id.vendor != XKEYS_VENDOR || id.product != XKEYS_PRODUCT || id.bustype == BUS_VIRTUAL) {
-			close(fd);
+/* the evdev method reads from the fd that grabbed the node, if any */
+static int take_event_device(int num)
+{
+	int i, fd;
+
+	for (i = 0; i < grabbed_count; i++) {
+		if (grabbed[i].num != num)
 			continue;
-		}
+		fd = grabbed[i].fd;
+		grabbed[i] = grabbed[--grabbed_count];
+		return fd;
+	}
+	return -1;
+}
 
-		if (ioctl(fd, EVIOCGRAB, 1))
-			log_err("Unable to grab event device (%s)\n", strerror(errno));
-		ev_fds[found++] = fd;
+static void release_event_device(int num)
+{
+	int i;
 
-		if (found >= max) {
-			log_err("Max devices reached, ignoring others\n");
-			return found;
-		}
+	for (i = 0; i < grabbed_count; i++) {
+		if (grabbed[i].num != num)
+			continue;
+		close(grabbed[i].fd);
+		grabbed[i] = grabbed[--grabbed_count];
+		return;
 	}
-	globfree(&buf);
+}
+
+static int grab_devices(void)
+{
+	int i;
 
-	return found;
+	for (i = 0; i < sysfs_index.nevent; i++) {
+		if (!should_grab(&sysfs_index.event[i]))
+			continue;
+		if (grab_event_device(sysfs_index.event[i].num))
+			return -1;
+	}
+
+	return grabbed_count;
 }
 
 #if 0
 device definition
 {
-	method = [evdev|hidraw];		/* default evdev */
+	method = [evdev|hidraw];		/* default hidraw */
 
 	vendor = <id>;			\
 	product = <id>;			|
@@ -162,72 +204,213 @@ device definition
 	rel_axisX = ...;
 	abs_axisY = ...;
 }
-add to struct device:
-	- serial (for device serial name)
-	- method (evdev, hidraw)
 #endif
 
-#define MAX_PRESSED_KEYS	10
-struct key_map;
-struct key_map {
-	uint16_t code[MAX_PRESSED_KEYS];
-	struct key_map *next;
-};
-
-#define XKEYS_NKEYS 46
-struct device {
-	int fd;
-	int uinput;
-	char filename[128];
-	char name[64];
-	uint16_t vendor;
-	uint16_t product;
-	struct key_map key_mapping[XKEYS_NKEYS];
-	uint16_t axle_mapping[2]; 
-	uint16_t last_axle_value[2];
-};
-
-static int new_device_from_config(config_setting_t *setting, struct input_translate *priv, struct device *new)
+/*
+ * repeatX = { mode = "sequence" | "last"; delay = <ms>; rate = <per second>; }
+ * delay and rate default to the device's repeat_delay and repeat_rate
+ */
+static int read_repeat(config_setting_t *setting, int key, int delay, int rate,
+		       struct macro *macro)
 {
-	struct input_translate_type event;
 	config_setting_t *tmp;
-	char keyname[6], *value;
-	int i, index;
+	const char *mode;
 
-	new->fd = -1;
+	if (macro->npress == 0) {
+		log_err("repeat%i set for a key without mapping\n", key);
+		return 1;
+	}
+	tmp = config_setting_get_member(setting, "mode");
+	mode = tmp ? config_setting_get_string(tmp) : NULL;
+	if (mode != NULL && !strcmp(mode, "sequence"))
+		macro->repeat = REPEAT_SEQUENCE;
+	else if (mode != NULL && !strcmp(mode, "last"))
+		macro->repeat = REPEAT_LAST;
+	else if (mode == NULL || strcmp(mode, "none")) {
+		log_err("Unknown repeat mode for key%i, either sequence, last or none\n",
+			key);
+		return 1;
+	}
 
-	tmp = config_setting_get_member(setting, "name");
+	tmp = config_setting_get_member(setting, "delay");
 	if (tmp != NULL)
-		snprintf(new->name, sizeof(new->name), config_setting_get_string(tmp));
-	else
-		strncpy(new->name, "noname", sizeof(new->name));
-
-	tmp = config_setting_get_member(setting, "device");
+		delay = config_setting_get_int(tmp);
+	tmp = config_setting_get_member(setting, "rate");
 	if (tmp != NULL)
-		snprintf(new->filename, sizeof(new->filename), config_setting_get_string(tmp));
+		rate = config_setting_get_int(tmp);
+	if (delay < 0 || delay > MACRO_MAX_DELAY || rate < 1 || rate > 1000) {
+		log_err("Invalid repeat delay or rate for key%i\n", key);
+		return 1;
+	}
+	macro->repeat_delay = delay;
+	macro->repeat_interval = 1000 / rate;
+	return 0;
+}
 
-	tmp = config_setting_get_member(setting, "vendor");
+/*
+ * gestureX = { hold = <macro>; hold_time = <ms>; double = <macro>; double_time = <ms>; }
+ * the times default to the device's hold_time and double_time
+ */
+static int read_gesture(config_setting_t *setting, struct input_translate *priv,
+			int key, int hold_time, int double_time,
+			struct macro *macro)
+{
+	struct gesture *g;
+	config_setting_t *tmp;
+	char *value;
+
+	if (macro->repeat) {
+		log_err("key%i can't have both gestures and repeat\n", key);
+		return 1;
+	}
+	g = calloc(1, sizeof(*g));
+	if (g == NULL) {
+		log_err("Not enough memory\n");
+		return 1;
+	}
+	macro->gesture = g;
+
+	tmp = config_setting_get_member(setting, "hold");
 	if (tmp != NULL) {
-		new->vendor = config_setting_get_int(tmp);
-		tmp = config_setting_get_member(setting, "product");
-		if (tmp == NULL) {
-			log_err("When vendor id is specified, product id must be specified too\n");
+		value = config_setting_get_string(tmp);
+		if (value == NULL || compile_macro(priv, value, &g->hold)) {
+			log_err("Error parsing hold macro for key%i\n", key);
+			return 1;
+		}
+	}
+	tmp = config_setting_get_member(setting, "double");
+	if (tmp != NULL) {
+		value = config_setting_get_string(tmp);
+		if (value == NULL || compile_macro(priv, value, &g->dtap)) {
+			log_err("Error parsing double tap macro for key%i\n", key);
 			return 1;
 		}
-		new->product = config_setting_get_int(tmp);
+	}
+	if (g->hold.npress == 0 && g->dtap.npress == 0) {
+		log_err("gesture%i needs a hold or double macro\n", key);
+		return 1;
 	}
 
-	if (strlen(new->filename) == 0 && new->vendor == 0) {
-		log_err("Either 'device' or vendor/product ids must be supplied");
+	tmp = config_setting_get_member(setting, "hold_time");
+	if (tmp != NULL)
+		hold_time = config_setting_get_int(tmp);
+	tmp = config_setting_get_member(setting, "double_time");
+	if (tmp != NULL)
+		double_time = config_setting_get_int(tmp);
+	if (hold_time < 1 || hold_time > MACRO_MAX_DELAY ||
+	    double_time < 1 || double_time > MACRO_MAX_DELAY) {
+		log_err("Invalid hold or double tap time for key%i\n", key);
+		return 1;
+	}
+	g->hold_time = hold_time;
+	g->double_time = double_time;
+	return 0;
+}
+
+/*
+ * the layers of a device are looked up by name, "base" is the one of the
+ * keys outside any layer. returns -1 if there's no such layer
+ */
+static int find_layer(config_setting_t *layers, const char *name)
+{
+	config_setting_t *tmp, *layer;
+	const char *value;
+	int i;
+
+	if (!strcmp(name, "base"))
+		return 0;
+	for (i = 0; layers && (layer = config_setting_get_elem(layers, i)); i++) {
+		tmp = config_setting_get_member(layer, "name");
+		value = tmp ? config_setting_get_string(tmp) : NULL;
+		if (value != NULL && !strcmp(value, name))
+			return i + 1;
+	}
+	return -1;
+}
+
+/* layerX = { layer = <name>; mode = "switch" | "toggle" | "hold"; } */
+static int read_layer_action(config_setting_t *setting, config_setting_t *layers,
+			     int key, struct macro *macro)
+{
+	config_setting_t *tmp;
+	const char *mode, *name;
+	int layer;
+
+	if (macro->gesture) {
+		log_err("key%i can't have both gestures and a layer action\n", key);
+		return 1;
+	}
+	tmp = config_setting_get_member(setting, "mode");
+	mode = tmp ? config_setting_get_string(tmp) : NULL;
+	if (mode != NULL && !strcmp(mode, "switch"))
+		macro->layer_mode = LAYER_SWITCH;
+	else if (mode != NULL && !strcmp(mode, "toggle"))
+		macro->layer_mode = LAYER_TOGGLE;
+	else if (mode != NULL && !strcmp(mode, "hold"))
+		macro->layer_mode = LAYER_HOLD;
+	else {
+		log_err("Unknown layer mode for key%i, either switch, toggle or hold\n",
+			key);
 		return 1;
 	}
 
-	for (i = 0; i < XKEYS_NKEYS; i++) {
-		const char *delim1 = ";", *delim2 = "+";
-		char *tmp1, *tmp2, *saved1, *saved2, *token;
-		int j;
-		struct key_map *prev = NULL, *cur;
+	tmp = config_setting_get_member(setting, "layer");
+	name = tmp ? config_setting_get_string(tmp) : NULL;
+	layer = name ? find_layer(layers, name) : -1;
+	if (layer < 0) {
+		log_err("Unknown layer %s for key%i\n", name ? name : "", key);
+		return 1;
+	}
+	macro->layer = layer;
+	return 0;
+}
 
+/* a setting of a layer, or the device's if the layer doesn't have it */
+static config_setting_t *layer_member(config_setting_t *setting,
+				      config_setting_t *device, const char *name)
+{
+	config_setting_t *tmp = config_setting_get_member(setting, name);
+
+	return tmp ? tmp : config_setting_get_member(device, name);
+}
+
+static int read_dial(config_setting_t *tmp, struct input_translate *priv,
+		     const char *name, uint16_t *axle)
+{
+	struct input_translate_type event;
+	char *value;
+
+	value = config_setting_get_string(tmp);
+	if (value == NULL) {
+		log_err("Error parsing key value for %s\n", name);
+		return 1;
+	}
+	if (input_translate_string(priv, value, &event)) {
+		log_err("Unable to parse key %s\n", value);
+		return 1;
+	}
+	if (event.type != EV_REL) {
+		log_err("Event %s is not supported yet for %s, only REL_ events\n",
+			value, name);
+		return 1;
+	}
+	*axle = event.code;
+	return 0;
+}
+
+/*
+ * the keys and dials of a layer, which is 'device' itself for the base
+ * one. other layers use the dials of the base one unless they set them
+ */
+static int read_mapping(config_setting_t *setting, config_setting_t *device,
+			struct input_translate *priv, struct mapping *mapping)
+{
+	config_setting_t *tmp, *layers;
+	char keyname[16], *value;
+	int i, delay = REPEAT_DELAY, rate = REPEAT_RATE;
+	int hold_time = GESTURE_HOLD_TIME, double_time = GESTURE_DOUBLE_TIME;
+
+	for (i = 0; i < XKEYS_MAX_KEYS; i++) {
 		sprintf(keyname, "key%i", i);
 		tmp = config_setting_get_member(setting, keyname);
 		if (tmp == NULL)
@@ -237,114 +420,229 @@ static int new_device_from_config(config_setting_t *setting, struct input_transl
 			log_err("Error parsing key value for key%i\n", i);
 			return 1;
 		}
+		if (compile_macro(priv, value, &mapping->keys[i]))
+			return 1;
+	}
 
-		/*
-		 * key config format works like this:
-		 * key12 = KEY_LEFTALT+KEY_T;KEY_LEFTCTRL+KEY_LEFTALT+KEY_DELETE;KEY_A
-		 * will generate alt+t, ctrl+alt+del, a
-		 * everything in one block (delimited by ';') will be pressed then
-		 * released at the same time. this means that each ";" represents a
-		 * "release all keys". This means that:
-		 *	key12 = KEY_LEFTCTRL;KEY_LEFTALT;KEY_DELETE
-		 * is different from
-		 * 	key12 = KEY_LEFTCTRL+KEY_LEFTALT+KEY_DELETE
-		 * in the sense that the former will press and release each of the
-		 * keys separately while the last will press all of them then release
-		 * all of them.
-		 *
-		 * The limit of keys pressed is controlled by MAX_KEYS_PRESSED
-		 */
-		for (tmp1 = value; ; tmp1 = NULL) {
-			token = strtok_r(tmp1, delim1, &saved1);
-			if (token == NULL)
-				break;
+	tmp = layer_member(setting, device, "repeat_delay");
+	if (tmp != NULL)
+		delay = config_setting_get_int(tmp);
+	tmp = layer_member(setting, device, "repeat_rate");
+	if (tmp != NULL)
+		rate = config_setting_get_int(tmp);
+	for (i = 0; i < XKEYS_MAX_KEYS; i++) {
+		sprintf(keyname, "repeat%i", i);
+		tmp = config_setting_get_member(setting, keyname);
+		if (tmp == NULL)
+			continue;
+		if (read_repeat(tmp, i, delay, rate, &mapping->keys[i]))
+			return 1;
+	}
 
-			if (prev == NULL)
-				cur = &new->key_mapping[i];
-			else {
-				cur = malloc(sizeof(*cur));
-				if (cur == NULL) {
-					log_err("Not enought memory\n");
-					exit(1);
-				}
-				memset(cur, 0, sizeof(*cur));
-				prev->next = cur;
-			}
-			for (j = 0, tmp2 = token; ; tmp2 = NULL, j++) {
-				token = strtok_r(tmp2, delim2, &saved2);
-				if (token == NULL)
-					break;
-
-				if (input_translate_string(priv, token, &event)) {
-					log_err("Unable to parse key %s\n", token);
-					return 1;
-				}
-				if (event.type != EV_KEY) {
-					log_err("Event %s is not supported yet, only KEY_ events\n", token);
-					return 1;
-				}
-				if (j >= MAX_PRESSED_KEYS) {
-					log_err("Maximum of pressed keys reached (%i)\n", MAX_PRESSED_KEYS);
-					return 1;
-				}
-				cur->code[j] = event.code;
-			}
-			prev = cur; 
-		}
+	tmp = layer_member(setting, device, "hold_time");
+	if (tmp != NULL)
+		hold_time = config_setting_get_int(tmp);
+	tmp = layer_member(setting, device, "double_time");
+	if (tmp != NULL)
+		double_time = config_setting_get_int(tmp);
+	for (i = 0; i < XKEYS_MAX_KEYS; i++) {
+		sprintf(keyname, "gesture%i", i);
+		tmp = config_setting_get_member(setting, keyname);
+		if (tmp == NULL)
+			continue;
+		if (read_gesture(tmp, priv, i, hold_time, double_time,
+				 &mapping->keys[i]))
+			return 1;
 	}
+
+	layers = config_setting_get_member(device, "layers");
+	for (i = 0; i < XKEYS_MAX_KEYS; i++) {
+		sprintf(keyname, "layer%i", i);
+		tmp = config_setting_get_member(setting, keyname);
+		if (tmp == NULL)
+			continue;
+		if (read_layer_action(tmp, layers, i, &mapping->keys[i]))
+			return 1;
+	}
+
 	tmp = config_setting_get_member(setting, "idial");
 	if (tmp == NULL) {
-		log_err("Internal dial (idial) not set\n");
-	} else {
-		value = config_setting_get_string(tmp);
-		if (value == NULL) {
-			log_err("Error parsing key value for idial\n");
+		if (setting == device)
+			log_err("Internal dial (idial) not set\n");
+	} else if (read_dial(tmp, priv, "idial", &mapping->axles[0]))
+		return 1;
+
+	tmp = config_setting_get_member(setting, "edial");
+	if (tmp == NULL) {
+		if (setting == device)
+			log_err("External dial (edial) not set\n");
+	} else if (read_dial(tmp, priv, "edial", &mapping->axles[1]))
+		return 1;
+
+	return 0;
+}
+
+/*
+ * layers = ( { name = <name>; keyX = ...; ... }, ... ) in a device, each
+ * compiled into its own mapping
+ */
+static int read_layers(config_setting_t *device, struct input_translate *priv,
+		       struct mapping *base)
+{
+	config_setting_t *layers, *layer, *tmp;
+	struct mapping *mapping;
+	const char *name;
+	int i;
+
+	strcpy(base->name, "base");
+	if (read_mapping(device, device, priv, base))
+		return 1;
+	layers = config_setting_get_member(device, "layers");
+	if (layers == NULL)
+		return 0;
+	if (!config_setting_is_list(layers) ||
+	    config_setting_length(layers) >= MAX_LAYERS) {
+		log_err("layers must be a list of up to %i layers\n",
+			MAX_LAYERS - 1);
+		return 1;
+	}
+	for (i = 0; (layer = config_setting_get_elem(layers, i)); i++) {
+		tmp = config_setting_get_member(layer, "name");
+		name = tmp ? config_setting_get_string(tmp) : NULL;
+		if (!config_setting_is_group(layer) || name == NULL ||
+		    strlen(name) >= LAYER_NAME_SIZE ||
+		    find_layer(layers, name) != i + 1) {
+			log_err("Layer %i needs a name of its own, up to %i characters\n",
+				i + 1, LAYER_NAME_SIZE - 1);
 			return 1;
 		}
-		if (input_translate_string(priv, value, &event)) {
-			log_err("Unable to parse key %s\n", value);
+		mapping = calloc(1, sizeof(*mapping));
+		if (mapping == NULL) {
+			log_err("Not enough memory\n");
 			return 1;
 		}
-		if (event.type != EV_REL) {
-			log_err("Event %s is not supported yet for idial, only REL_ events\n", value);
+		base->layers[i] = mapping;
+		base->nlayers = i + 1;
+		strcpy(mapping->name, name);
+		mapping->axles[0] = base->axles[0];
+		mapping->axles[1] = base->axles[1];
+		if (read_mapping(layer, device, priv, mapping)) {
+			log_err("Error in layer %s\n", name);
 			return 1;
 		}
-		new->axle_mapping[0] = event.code;
 	}
+	return 0;
+}
 
-	tmp = config_setting_get_member(setting, "edial");
-	if (tmp == NULL) {
-		log_err("External dial (idial) not set\n");
-	} else {
+static int new_device_from_config(config_setting_t *setting, struct input_translate *priv, struct device *new)
+{
+	config_setting_t *tmp;
+	char *value;
+
+	new->fd = -1;
+	new->uinput = -1;
+	new->hidraw = -1;
+	new->event = -1;
+	new->mapping = calloc(1, sizeof(*new->mapping));
+	if (new->mapping == NULL) {
+		log_err("Not enough memory\n");
+		return 1;
+	}
+
+	tmp = config_setting_get_member(setting, "name");
+	if (tmp != NULL)
+		snprintf(new->name, sizeof(new->name), config_setting_get_string(tmp));
+	else
+		strncpy(new->name, "noname", sizeof(new->name));
+
+	tmp = config_setting_get_member(setting, "device");
+	if (tmp != NULL)
+		snprintf(new->filename, sizeof(new->filename), config_setting_get_string(tmp));
+
+	tmp = config_setting_get_member(setting, "vendor");
+	if (tmp != NULL) {
+		new->vendor = config_setting_get_int(tmp);
+		tmp = config_setting_get_member(setting, "product");
+		if (tmp == NULL) {
+			log_err("When vendor id is specified, product id must be specified too\n");
+			return 1;
+		}
+		new->product = config_setting_get_int(tmp);
+
+		tmp = config_setting_get_member(setting, "serial");
+		if (tmp != NULL)
+			snprintf(new->serial, sizeof(new->serial), "%s",
+				 config_setting_get_string(tmp));
+	}
+
+	tmp = config_setting_get_member(setting, "method");
+	if (tmp != NULL) {
 		value = config_setting_get_string(tmp);
-		if (value == NULL) {
-			log_err("Error parsing key value for edial\n");
+		if (value != NULL && !strcmp(value, "evdev"))
+			new->method = METHOD_EVDEV;
+		else if (value == NULL || strcmp(value, "hidraw")) {
+			log_err("Unknown method for device %s, either evdev or hidraw\n",
+				new->name);
 			return 1;
 		}
-		if (input_translate_string(priv, value, &event)) {
-			log_err("Unable to parse key %s\n", value);
+	}
+
+	if (strlen(new->filename) == 0 && new->vendor == 0) {
+		log_err("Either 'device' or vendor/product ids must be supplied");
+		return 1;
+	}
+
+	/* the event ring is in addition to uinput, or instead of it */
+	new->sinks = SINK_UINPUT;
+	tmp = config_setting_get_member(setting, "ring");
+	if (tmp != NULL) {
+		value = config_setting_get_string(tmp);
+		if (value == NULL || strlen(value) == 0 ||
+		    strlen(value) >= sizeof(new->ring_name) ||
+		    strchr(value + 1, '/')) {
+			log_err("Invalid ring name for device %s\n", new->name);
 			return 1;
 		}
-		if (event.type != EV_REL) {
-			log_err("Event %s is not supported yet for edial, only REL_ events\n", value);
+		snprintf(new->ring_name, sizeof(new->ring_name), "%s", value);
+		new->sinks |= SINK_RING;
+		new->ring_size = RING_DEFAULT_SIZE;
+		tmp = config_setting_get_member(setting, "ring_size");
+		if (tmp != NULL)
+			new->ring_size = config_setting_get_int(tmp);
+		if (new->ring_size < RING_MIN_SIZE ||
+		    new->ring_size > RING_MAX_SIZE ||
+		    (new->ring_size & (new->ring_size - 1))) {
+			log_err("Ring size for device %s must be a power of two from %i to %i\n",
+				new->name, RING_MIN_SIZE, RING_MAX_SIZE);
 			return 1;
 		}
-		new->axle_mapping[1] = event.code;
+	}
+	tmp = config_setting_get_member(setting, "uinput");
+	if (tmp != NULL && !config_setting_get_bool(tmp)) {
+		if (!(new->sinks & SINK_RING)) {
+			log_err("Device %s needs either uinput or a ring\n",
+				new->name);
+			return 1;
+		}
+		new->sinks &= ~SINK_UINPUT;
 	}
 
+	if (read_layers(setting, priv, new->mapping))
+		return 1;
+	new->active = new->mapping;
 	return 0;
 }
 
-static struct device devices[HIDRAW_MAX_DEVICES];
-static int device_count;
+static char *config_filename;
 
-static int read_config(char *filename)
+/* parses the devices in the configuration file into 'devs' */
+static int read_config(char *filename, struct device *devs, int *count)
 {
 	config_t config;
-	config_setting_t *root, *tmp, *devs;
+	config_setting_t *root, *tmp, *devs_setting;
 	struct input_translate *priv;
 	struct device *dev;
-	int version, i, ret;
+	int version, i, ret = 1;
 
 	priv = input_translate_init();
 	if (priv == NULL) {
@@ -353,94 +651,217 @@ static int read_config(char *filename)
 	}
 
 	config_init(&config);
-	ret = config_read_file(&config, filename);
-	if (ret == CONFIG_FALSE) {
+	if (config_read_file(&config, filename) == CONFIG_FALSE) {
 		log_err("Error reading config file: %s (%s:%i)\n",
 			config_error_text(&config), filename,
 			config_error_line(&config));
-		return 1;
+		goto out;
 	}
 
 	tmp = config_lookup(&config, "version");
 	if (tmp == NULL) {
 		log_err("Error config file version in %s (%s)\n",
 			filename, config_error_text(&config));
-		return 1;
+		goto out;
 	}
 	version = config_setting_get_int(tmp);
 
-	devs = config_lookup(&config, "devices");
-	if (devs == NULL) {
+	devs_setting = config_lookup(&config, "devices");
+	if (devs_setting == NULL) {
 		log_err("Error getting devices block in %s (%s)\n",
 			filename, config_error_text(&config));
-		return 1;
+		goto out;
 	}
 
 	for (i = 0; i < HIDRAW_MAX_DEVICES; i++) {
-		tmp = config_setting_get_elem(devs, i);
+		tmp = config_setting_get_elem(devs_setting, i);
 		if (tmp == NULL)
 			break;
 
 		if (!config_setting_is_group(tmp)) {
 			log_err("Error in device definition for %s\n",
 				config_setting_name(tmp));
-			return 1;
+			goto out;
+		}
+		if (new_device_from_config(tmp, priv, &devs[*count])) {
+			/* partially parsed, so it's freed here */
+			mapping_free(devs[*count].mapping);
+			devs[*count].mapping = NULL;
+			goto out;
+		}
+		devs[*count].id = *count;
+		(*count)++;
+	}
+	ret = 0;
+out:
+	config_destroy(&config);
+	return ret;
+}
+
+
+static char *cache_filename = CACHE_FILE;
+
+/*
+ * the cache is used if it was made from the current configuration file,
+ * otherwise the file is parsed and the cache written for the next time
+ */
+static int load_config(struct device *devs, int *count)
+{
+	if (cache_filename &&
+	    !cache_load(cache_filename, config_filename, devs, count))
+		return 0;
+	if (read_config(config_filename, devs, count))
+		return 1;
+	if (cache_filename)
+		cache_save(cache_filename, config_filename, devs, *count);
+	return 0;
+}
+
+static int device_matches(struct device *dev, const struct sysfs_node *node)
+{
+	if (strlen(dev->filename)) {
+		char filename[32];
+
+		snprintf(filename, sizeof(filename), "/dev/hidraw%i", node->num);
+		return !strcmp(dev->filename, filename);
+	}
+	if (dev->vendor != node->vendor || dev->product != node->product)
+		return 0;
+	return !strlen(dev->serial) || !strcmp(dev->serial, node->serial);
+}
+
+static int hidraw_search(struct device *dev, int *num)
+{
+	const struct sysfs_node *node;
+	char filename[32];
+	int fd, i;
+
+	for (i = 0; i < sysfs_index.nhidraw; i++) {
+		node = &sysfs_index.hidraw[i];
+		if (get_ohd_bit(node->num) || !device_matches(dev, node))
+			continue;
+
+		snprintf(filename, sizeof(filename), "/dev/hidraw%i", node->num);
+		fd = open(filename, O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EPERM || errno == EACCES) {
+				log_err("Not enough privileges to open %s\n", filename);
+				return -1;
+			}
+			continue;
 		}
-		if (new_device_from_config(tmp, priv, &devices[device_count]))
+		set_ohd_bit(node->num);
+		*num = node->num;
+		return fd;
+	}
+	errno = ENODEV;
+	return -1;
+}
+
+static int event_matches(struct device *dev, const struct sysfs_node *node)
+{
+	if (strlen(dev->filename)) {
+		char filename[32];
+
+		snprintf(filename, sizeof(filename), "/dev/input/event%i", node->num);
+		return !strcmp(dev->filename, filename);
+	}
+	if (node->bus == BUS_VIRTUAL || dev->vendor != node->vendor ||
+	    dev->product != node->product)
+		return 0;
+	return !strlen(dev->serial) || !strcmp(dev->serial, node->serial);
+}
+
+static int event_in_use(int num)
+{
+	int i;
+
+	for (i = 0; i < device_count; i++)
+		if (devices[i].event == num)
 			return 1;
-		device_count++;
+	return 0;
+}
+
+/* the event node is grabbed, so nobody else gets the device's events */
+static void open_event_device(struct device *dev, int num)
+{
+	char filename[32];
+
+	dev->fd = take_event_device(num);
+	if (dev->fd < 0) {
+		snprintf(filename, sizeof(filename), "/dev/input/event%i", num);
+		dev->fd = open(filename, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (dev->fd < 0)
+			return;
+		if (ioctl(dev->fd, EVIOCGRAB, 1))
+			log_err("Unable to grab event device (%s)\n", strerror(errno));
+	}
+	dev->event = num;
+}
+
+static void locate_and_open(struct device *dev)
+{
+	int i;
+
+	if (dev->method == METHOD_EVDEV) {
+		errno = ENODEV;
+		for (i = 0; i < sysfs_index.nevent; i++) {
+			if (event_in_use(sysfs_index.event[i].num) ||
+			    !event_matches(dev, &sysfs_index.event[i]))
+				continue;
+			open_event_device(dev, sysfs_index.event[i].num);
+			return;
+		}
+		return;
 	}
 
-	return 0;
+	if (strlen(dev->filename)) {
+		dev->fd = open(dev->filename, O_RDONLY | O_CLOEXEC);
+		if (dev->fd >= 0 &&
+		    sscanf(dev->filename, "/dev/hidraw%i", &dev->hidraw) == 1)
+			set_ohd_bit(dev->hidraw);
+	} else
+		dev->fd = hidraw_search(dev, &dev->hidraw);
 }
 
-
-static int hidraw_search(int vendor, int product)
+/* the keys a macro may press, including the ones of its gestures */
+static void macro_key_bits(const struct macro *macro, unsigned long *bits)
 {
-	int fd = -1, i;
-	char filename[] = "/dev/hidrawXXX";
-	struct hidraw_devinfo info;
-
-	for (i = 0; i < HIDRAW_MAX_DEVICES; i++) {
-		if (get_ohd_bit(i))
-			continue;
-		snprintf(filename, sizeof(filename) + 1, "/dev/hidraw%i",
-			 i);
-		fd = open(filename, O_RDWR);
-		if (fd < 0) {
-			if (errno == EPERM) {
-				log_err("Not enough privileges to open /dev/hidraw%i\n");
-				return -1;
-			}
-			continue;
-		}
-		if (ioctl(fd, HIDIOCGRAWINFO, &info)) {
-			log_err("Error retrieving device information from hidraw%i: %s\n",
-				i, strerror(errno));
-			close(fd);
-			continue;
-		}
-		if (info.vendor == vendor && info.product == product) {
-			set_ohd_bit(i);
-			return fd;
-		}
+	int j;
+
+	for (j = 0; j < macro->npress; j++)
+		if (macro->ev[j].type == EV_KEY)
+			bits[macro->ev[j].code / BITS_PER_LONG] |=
+				1UL << (macro->ev[j].code % BITS_PER_LONG);
+	if (macro->gesture) {
+		macro_key_bits(&macro->gesture->hold, bits);
+		macro_key_bits(&macro->gesture->dtap, bits);
 	}
-	close(fd);
-	return -1;
 }
 
-static void locate_and_open(struct device *dev)
+/* the keys and axles of every layer, which uinput_init() registers */
+static void mapping_bits(struct mapping *mapping, unsigned long *keys,
+			 unsigned long *rels)
 {
-	if (strlen(dev->filename))
-		dev->fd = open(dev->filename, O_RDONLY);
-	else
-		dev->fd = hidraw_search(dev->vendor, dev->product);
+	struct mapping *layer;
+	int i, l;
+
+	for (l = 0; l <= mapping->nlayers; l++) {
+		layer = mapping_layer(mapping, l);
+		for (i = 0; i < XKEYS_MAX_KEYS; i++)
+			macro_key_bits(&layer->keys[i], keys);
+		for (i = 0; i < 2; i++)
+			rels[layer->axles[i] / BITS_PER_LONG] |=
+				1UL << (layer->axles[i] % BITS_PER_LONG);
+	}
 }
 
 /* TODO: get rid of dev->name kludge */
 static int uinput_init(struct device *dev)
 {
 	struct uinput_user_dev udev;
+	unsigned long bits[KEY_CNT / BITS_PER_LONG + 1];
+	unsigned long rels[REL_CNT / BITS_PER_LONG + 1];
 	int i;
 
 	dev->uinput = open(UINPUT_FILE, O_RDWR);
@@ -456,7 +877,7 @@ static int uinput_init(struct device *dev)
 
 	udev.id.bustype = BUS_VIRTUAL;
 	udev.id.vendor = XKEYS_VENDOR;
-	udev.id.product = XKEYS_PRODUCT;
+	udev.id.product = dev->model ? dev->model->product : dev->product;
 	udev.id.version = 1;
 
 	if (write(dev->uinput, &udev, sizeof(udev)) != sizeof(udev)) {
@@ -468,11 +889,15 @@ static int uinput_init(struct device *dev)
 		log_err("Error enabling key events in uinput device (%s)\n", strerror(errno));
 		goto err;
 	}
-	for (i = 0; i < 2; i++) {
-		if (ioctl(dev->uinput, UI_SET_RELBIT, dev->axle_mapping[i])) {
+	memset(bits, 0, sizeof(bits));
+	memset(rels, 0, sizeof(rels));
+	mapping_bits(dev->mapping, bits, rels);
+	for (i = 0; i < REL_CNT; i++) {
+		if (!(rels[i / BITS_PER_LONG] & (1UL << (i % BITS_PER_LONG))))
+			continue;
+		if (ioctl(dev->uinput, UI_SET_RELBIT, i)) {
 			log_err("Error enabling axis %s events: %s\n",
-				input_translate_code(EV_REL, dev->axle_mapping[i]),
-				strerror(errno));
+				input_translate_code(EV_REL, i), strerror(errno));
 			goto err;
 		}
 	}
@@ -481,21 +906,13 @@ static int uinput_init(struct device *dev)
 		log_err("Error enabling key events in uinput device (%s)\n", strerror(errno));
 		goto err;
 	}
-	for (i = 0; i < XKEYS_NKEYS; i++) {
-		int j;
-		struct key_map *cur;
-
-		for (cur = &dev->key_mapping[i]; cur; cur = cur->next) {
-			for (j = 0; j < MAX_PRESSED_KEYS; j++) {
-				if (cur->code[j] == 0)
-					continue;
-				if (ioctl(dev->uinput, UI_SET_KEYBIT, cur->code[j])) {
-					log_err("Error enabling key %s in uinput device: %s\n",
-						input_translate_code(EV_KEY, cur->code[j]),
-						strerror(errno));
-					goto err;
-				}
-			}
+	for (i = 0; i < KEY_CNT; i++) {
+		if (!(bits[i / BITS_PER_LONG] & (1UL << (i % BITS_PER_LONG))))
+			continue;
+		if (ioctl(dev->uinput, UI_SET_KEYBIT, i)) {
+			log_err("Error enabling key %s in uinput device: %s\n",
+				input_translate_code(EV_KEY, i), strerror(errno));
+			goto err;
 		}
 	}
 
@@ -511,7 +928,7 @@ static int uinput_init(struct device *dev)
 		goto err;
 	}
 	if (ioctl(dev->uinput, UI_SET_KEYBIT, BTN_0)) {
-		log_err("Error enabling key BTN_0 in uinput device\n",
+		log_err("Error enabling key BTN_0 in uinput device (%s)\n",
 			strerror(errno));
 		goto err;
 	}
@@ -528,200 +945,671 @@ err:
 	return -1;
 }
 
-static int select_init(fd_set *set, struct device *devices, int count)
+/* compiles the decoding plan from the device's HID report descriptor */
+static int read_hid_plan(struct device *dev)
 {
-	int i, highest = -1;
+	struct hidraw_report_descriptor desc;
+	struct hid_plan *plan;
+	int size;
 
-	FD_ZERO(set);
-	for (i = 0; i < count; i++)
-		if (devices[i].fd >= 0) {
-			if (devices[i].fd > highest)
-				highest = devices[i].fd;
-			FD_SET(devices[i].fd, set);
-		}
-	return highest;
+	if (dev->fd < 0)
+		return 1;
+	if (ioctl(dev->fd, HIDIOCGRDESCSIZE, &size) ||
+	    size > HID_MAX_DESCRIPTOR_SIZE) {
+		log_err("Unable to get HID report descriptor size (%s)\n",
+			strerror(errno));
+		return 1;
+	}
+	desc.size = size;
+	if (ioctl(dev->fd, HIDIOCGRDESC, &desc)) {
+		log_err("Unable to get HID report descriptor (%s)\n",
+			strerror(errno));
+		return 1;
+	}
+
+	plan = malloc(sizeof(*plan));
+	if (plan == NULL) {
+		log_err("Not enough memory\n");
+		return 1;
+	}
+	if (hid_plan_compile(desc.value, desc.size, plan)) {
+		free(plan);
+		return 1;
+	}
+	device_set_plan(dev, plan);
+	log("Device \"%s\" decoded from its HID report descriptor: %u keys, %u dials\n",
+	    dev->name, plan->nkeys, plan->ndials);
+	return 0;
 }
 
-static int _write_input_event(struct device *dev, uint16_t type, uint16_t code, int32_t value)
+/*
+ * the model is told by the product id sysfs has for the hidraw node, or
+ * the one in the configuration. without either, it's a Jog & Shuttle.
+ * devices that aren't a known X-keys model go by their report descriptor
+ */
+static int find_model(struct device *dev)
 {
-	struct input_event ev;
+	struct sysfs_node node;
+	struct evdev_map *map;
+	uint16_t product = dev->product ? dev->product : XKEYS_PRODUCT;
+
+	if (dev->method == METHOD_EVDEV) {
+		map = malloc(sizeof(*map));
+		if (map == NULL || dev->fd < 0 || evdev_map_init(dev->fd, map)) {
+			free(map);
+			return 1;
+		}
+		device_set_evdev(dev, map);
+		return 0;
+	}
+
+	if (dev->hidraw >= 0 &&
+	    !sysfs_hidraw_info(SYSFS_ROOT, dev->hidraw, &node))
+		product = node.product;
+	if (!device_set_model(dev, product) || !read_hid_plan(dev))
+		return 0;
+	log_err("Device \"%s\" is not supported (product 0x%x)\n",
+		dev->name, product);
+	return 1;
+}
 
-	memset(&ev, 0, sizeof(ev));
-	ev.type = type;
-	ev.code = code;
-	ev.value = value;
-	if (write(dev->uinput, &ev, sizeof(ev)) < 0) {
-		log_err("Error writing event to uinput device (%s)\n", strerror(errno));
+/*
+ * the uinput device and the event ring, whichever the device has. the ring
+ * is kept while the device is unplugged, so readers don't lose it
+ */
+static int sinks_init(struct device *dev)
+{
+	if ((dev->sinks & SINK_UINPUT) && uinput_init(dev))
 		return 1;
+	if ((dev->sinks & SINK_RING) && dev->ring == NULL) {
+		dev->ring = ring_open(dev);
+		if (dev->ring == NULL) {
+			device_uinput_destroy(dev);
+			return 1;
+		}
 	}
 	return 0;
 }
 
-static int write_input_event(struct device *dev, uint16_t type, uint16_t code, int32_t value)
+/* creates the uinput counterpart of an opened device and starts using it */
+static int start_device(struct device *dev)
 {
-	if (_write_input_event(dev, type, code, value))
+	if (find_model(dev)) {
+		close(dev->fd);
+		dev->fd = -1;
+		return 1;
+	}
+	if (sinks_init(dev)) {
+		log_err("Error creating uinput device or ring for device \"%s\", not using device (%s)\n",
+			strlen(dev->name) ? dev->name:"noname",
+			strerror(errno));
+		close(dev->fd);
+		dev->fd = -1;
+		return 1;
+	}
+	if (device_attach(dev)) {
+		device_detach(dev);
 		return 1;
+	}
+	log("Device \"%s\" attached\n", dev->name);
+	return 0;
+}
+
+static void hidraw_added(int num)
+{
+	struct sysfs_node node;
+	char filename[32];
+	struct device *dev;
+	int i;
+
+	if (get_ohd_bit(num) || sysfs_hidraw_info(SYSFS_ROOT, num, &node))
+		return;
+
+	for (i = 0; i < device_count; i++) {
+		dev = &devices[i];
+		if (dev->mapping == NULL || dev->method != METHOD_HIDRAW ||
+		    dev->fd >= 0 || !device_matches(dev, &node))
+			continue;
 
-	return _write_input_event(dev, EV_SYN, SYN_REPORT, 1);
+		snprintf(filename, sizeof(filename), "/dev/hidraw%i", num);
+		dev->fd = open(filename, O_RDONLY | O_CLOEXEC);
+		if (dev->fd < 0) {
+			log_err("Error opening %s (%s)\n", filename, strerror(errno));
+			return;
+		}
+		dev->hidraw = num;
+		set_ohd_bit(num);
+		start_device(dev);
+		return;
+	}
 }
 
-static int run_macro_map(struct key_map *cur, int value, struct device *dev, uint16_t type)
+static void hidraw_removed(int num)
 {
-	int j, code;
+	int i;
 
-	for (j = 0; j < MAX_PRESSED_KEYS; j++) {
-		code = cur->code[j];
-		if (code == 0)
-			break;
-		if (_write_input_event(dev, type, code, value)) {
-			return 1;
+	for (i = 0; i < device_count; i++) {
+		if (devices[i].hidraw != num)
+			continue;
+		if (devices[i].fd >= 0)
+			log("Device \"%s\" removed\n", devices[i].name);
+		device_detach(&devices[i]);
+		devices[i].hidraw = -1;
+	}
+	clear_ohd_bit(num);
+}
+
+static void event_added(int num, const struct sysfs_node *node)
+{
+	struct device *dev;
+	int i;
+
+	if (event_in_use(num))
+		return;
+	for (i = 0; i < device_count; i++) {
+		dev = &devices[i];
+		if (dev->mapping == NULL || dev->method != METHOD_EVDEV ||
+		    dev->fd >= 0 || !event_matches(dev, node))
+			continue;
+		open_event_device(dev, num);
+		if (dev->fd < 0) {
+			log_err("Error opening event device %i (%s)\n", num,
+				strerror(errno));
+			return;
 		}
+		start_device(dev);
+		return;
 	}
-	return _write_input_event(dev, EV_SYN, SYN_REPORT, 1);
 }
 
-static int run_macro(struct key_map *map, int val, struct device *dev, uint16_t type)
+static void event_removed(int num)
 {
-	struct key_map *cur;
-	int j, code, value = val? 1:0, multiple = 0;
+	int i;
 
-	for (cur = map; cur; cur = cur->next) {
-		if (cur->next != NULL || multiple) {
-			/* if there're multiple blocks, we don't support
-			 * press/release */
-			multiple = 1;
+	for (i = 0; i < device_count; i++) {
+		if (devices[i].event != num)
+			continue;
+		if (devices[i].fd >= 0)
+			log("Device \"%s\" removed\n", devices[i].name);
+		device_detach(&devices[i]);
+		devices[i].event = -1;
+	}
+	release_event_device(num);
+}
 
-			/*
-			 * since we already released the keys previously,
-			 * there's no need to generate key release events
-			 */
-			if (value == 0)
-				break;
+static void hotplug_event(const char *action, const char *subsystem,
+			  const char *devname)
+{
+	struct sysfs_node node;
+	int num;
+
+	if (!strcmp(subsystem, "hidraw") &&
+	    sscanf(devname, "hidraw%i", &num) == 1 &&
+	    num >= 0 && num < HIDRAW_MAX_DEVICES) {
+		if (!strcmp(action, "add"))
+			hidraw_added(num);
+		else if (!strcmp(action, "remove"))
+			hidraw_removed(num);
+	} else if (!strcmp(subsystem, "input") &&
+		   sscanf(devname, "input/event%i", &num) == 1) {
+		if (!strcmp(action, "add")) {
+			if (!sysfs_event_info(SYSFS_ROOT, num, &node) &&
+			    should_grab(&node)) {
+				grab_event_device(num);
+				event_added(num, &node);
+			}
 		}
+		else if (!strcmp(action, "remove"))
+			event_removed(num);
+	}
+}
 
-		if (run_macro_map(cur, value, dev, type))
-			return 1;
+/*
+ * whether both configurations describe the same physical device. one
+ * going to other sinks is taken as a new device, so they're set up again
+ */
+static int same_device(const struct device *a, const struct device *b)
+{
+	return !strcmp(a->filename, b->filename) && a->vendor == b->vendor &&
+	       a->product == b->product && !strcmp(a->serial, b->serial) &&
+	       a->method == b->method && a->sinks == b->sinks &&
+	       !strcmp(a->ring_name, b->ring_name) &&
+	       a->ring_size == b->ring_size;
+}
 
-		if (multiple)
-			/* multiple blocks, issue key release right now */
-			if (run_macro_map(cur, 0, dev, type))
-				return 1;
+/* whether uinput_init() would register the same events for both mappings */
+static int same_events(struct mapping *a, struct mapping *b)
+{
+	unsigned long bits[2][KEY_CNT / BITS_PER_LONG + 1];
+	unsigned long rels[2][REL_CNT / BITS_PER_LONG + 1];
+
+	memset(bits, 0, sizeof(bits));
+	memset(rels, 0, sizeof(rels));
+	mapping_bits(a, bits[0], rels[0]);
+	mapping_bits(b, bits[1], rels[1]);
+	return !memcmp(bits[0], bits[1], sizeof(bits[0])) &&
+	       !memcmp(rels[0], rels[1], sizeof(rels[0]));
+}
+
+/*
+ * moves a device already in use to its new mapping. the uinput device is
+ * only recreated if it has to register different events, as applications
+ * see that as a device going away and coming back
+ */
+static void update_device(struct device *dev, struct device *new)
+{
+	snprintf(dev->name, sizeof(dev->name), "%s", new->name);
+	if (dev->uinput < 0 || same_events(dev->mapping, new->mapping)) {
+		mapping_free(device_set_mapping(dev, new->mapping));
+		return;
 	}
-	return 0;
+
+	device_uinput_destroy(dev);
+	mapping_free(device_set_mapping(dev, new->mapping));
+	if (uinput_init(dev)) {
+		log_err("Error recreating uinput device for device \"%s\" (%s)\n",
+			dev->name, strerror(errno));
+		if (dev->hidraw >= 0)
+			clear_ohd_bit(dev->hidraw);
+		device_detach(dev);
+		dev->hidraw = -1;
+		dev->event = -1;
+		return;
+	}
+	log("Device \"%s\" recreated with the new mapping\n", dev->name);
 }
 
-#define SHUTTLE	2
-#define JOG	3
-#define KEYS	4
+/* a device no longer in the configuration leaves its slot unused */
+static void remove_device(struct device *dev)
+{
+	log("Device \"%s\" removed from the configuration\n", dev->name);
+	device_detach(dev);
+	if (dev->hidraw >= 0)
+		clear_ohd_bit(dev->hidraw);
+	dev->hidraw = -1;
+	dev->event = -1;
+	ring_close(dev->ring);
+	dev->ring = NULL;
+	mapping_free(dev->mapping);
+	dev->mapping = NULL;
+}
+
+static void add_device(struct device *new)
+{
+	struct device *dev;
+	int i;
+
+	for (i = 0; i < device_count; i++)
+		if (devices[i].mapping == NULL)
+			break;
+	if (i == HIDRAW_MAX_DEVICES) {
+		log_err("Too many devices, ignoring \"%s\"\n", new->name);
+		mapping_free(new->mapping);
+		return;
+	}
+	if (i == device_count)
+		device_count++;
+
+	dev = &devices[i];
+	*dev = *new;
+	dev->id = i;
+	locate_and_open(dev);
+	if (dev->fd < 0) {
+		log_err("Error opening/finding device \"%s\": %s\n", dev->name,
+			strerror(errno));
+		return;
+	}
+	start_device(dev);
+}
 
 /*
- *  0   7  14  18  22  26  30  37  44
- *  1   8  15  19  23  27  31  38  45
- *
- *  2   9   16  20  24  28  32  39
- *  3  10   17  21  25  29  33  40
- *  4  11                   34  41
- *  5  12                   35  42
- *  6  13                   36  43
+ * rereads the configuration file. nothing changes unless the whole file
+ * is parsed successfully, and each device switches to its new mapping
+ * between two reports, so no report is decoded with a mix of both
  */
-static struct {
-	unsigned char byte;
-	unsigned char bit;
-} xkeys_key_bits[] = {
-	{ 0, 0 }, { 0, 1 }, { 0, 2 }, { 0, 3 }, { 0, 4 }, { 0, 5 }, { 0, 6 },
-	{ 1, 0 }, { 1, 1 }, { 1, 2 }, { 1, 3 }, { 1, 4 }, { 1, 5 }, { 1, 6 },
-	{ 2, 0 }, { 2, 1 }, { 2, 2 }, { 2, 3 },
-	{ 3, 0 }, { 3, 1 }, { 3, 2 }, { 3, 3 },
-	{ 4, 0 }, { 4, 1 }, { 4, 2 }, { 4, 3 },
-	{ 5, 0 }, { 5, 1 }, { 5, 2 }, { 5, 3 },
-	{ 6, 0 }, { 6, 1 }, { 6, 2 }, { 6, 3 }, { 6, 4 }, { 6, 5 }, { 6, 6 },
-	{ 7, 0 }, { 7, 1 }, { 7, 2 }, { 7, 3 }, { 7, 4 }, { 7, 5 }, { 7, 6 },
-	{ 8, 0 }, { 8, 1 },
-};
-static int device_input(struct device *dev, char *last)
+static void reload_config(void)
 {
-	int ret = 0, i, size;
-	uint16_t type, code;
-	int32_t value;
-	char report[HID_MAX_DESCRIPTOR_SIZE], *rptr, *lptr;
+	struct device *new;
+	int count = 0, i, j;
+
+	new = aligned_alloc(__alignof__(*new),
+			    HIDRAW_MAX_DEVICES * sizeof(*new));
+	if (new == NULL) {
+		log_err("Not enough memory to reload the configuration\n");
+		return;
+	}
+	memset(new, 0, HIDRAW_MAX_DEVICES * sizeof(*new));
+	if (load_config(new, &count)) {
+		log_err("Error reloading %s, keeping the current configuration\n",
+			config_filename);
+		for (i = 0; i < count; i++)
+			mapping_free(new[i].mapping);
+		free(new);
+		return;
+	}
 
-	size = read(dev->fd, report, sizeof(report));
-	if (size < 0) {
-		log_err("Error reading from hidraw device (%s)\n", strerror(errno));
-		return 1;
+	/*
+	 * devices may have been plugged in since the last scan, and their
+	 * node numbers may have been reused by others
+	 */
+	if (sysfs_scan(SYSFS_ROOT, &sysfs_index)) {
+		log_err("Unable to rescan %s for devices (%s)\n", SYSFS_ROOT,
+			strerror(errno));
+		sysfs_free(&sysfs_index);
+	}
+
+	for (i = 0; i < device_count; i++) {
+		if (devices[i].mapping == NULL)
+			continue;
+		for (j = 0; j < count; j++)
+			if (new[j].mapping && same_device(&devices[i], &new[j]))
+				break;
+		if (j == count)
+			remove_device(&devices[i]);
+		else {
+			update_device(&devices[i], &new[j]);
+			new[j].mapping = NULL;
+		}
 	}
+	for (j = 0; j < count; j++)
+		if (new[j].mapping)
+			add_device(&new[j]);
+	free(new);
+	log("Configuration reloaded from %s\n", config_filename);
+}
 
-	if (!memcmp(last, report, size))
+static struct loop_source signal_source;
+static int signal_fd = -1;
+
+static int signal_input(struct loop_source *source)
+{
+	struct signalfd_siginfo info;
+	int i;
+
+	if (read(signal_fd, &info, sizeof(info)) != sizeof(info))
 		return 0;
 
-	if (last[1] != 2)
-		/* first run, ignore */
-		goto out;
+	switch (info.ssi_signo) {
+	case SIGUSR1:
+		for (i = 0; i < device_count; i++)
+			if (devices[i].mapping)
+				device_dump_stats(&devices[i]);
+		break;
+	case SIGHUP:
+		reload_config();
+		break;
+	}
+	return 0;
+}
 
-	if (report[1] != 2) {
-		log_err("error\n");
-		exit(1);
-	}
-	if (report[SHUTTLE] != last[SHUTTLE]) {
-		type = EV_REL;
-		code = dev->axle_mapping[1];
-		value = report[SHUTTLE] - last[SHUTTLE];
-		goto send;
-	}
-	if (report[JOG] != last[JOG]) {
-		type = EV_REL;
-		code = dev->axle_mapping[0];
-		value = report[JOG] - last[JOG];
-		goto send;
-	}
-	if (memcmp(&report[KEYS], &last[KEYS], 9)) {
-		unsigned char byte, bit;
-		type = EV_KEY;
-		rptr = &report[KEYS];
-		lptr = &last[KEYS];
-		for (i = 0; i < XKEYS_NKEYS; i++) {
-			byte = xkeys_key_bits[i].byte;
-			bit = 1 << xkeys_key_bits[i].bit;
-			if ((lptr[byte] & bit) == (rptr[byte] & bit))
-				/* key didn't change */
-				continue;
-			ret = run_macro(&dev->key_mapping[i],
-					(rptr[byte] & bit), dev, type);
-			if (ret)
-				goto out;
-		}
+/* signals are handled synchronously by the main loop through a signalfd */
+static int signals_init(void)
+{
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGHUP);
+	if (sigprocmask(SIG_BLOCK, &mask, NULL)) {
+		log_err("Error blocking signals (%s)\n", strerror(errno));
+		return 1;
+	}
+	signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (signal_fd < 0) {
+		log_err("Error creating signalfd (%s)\n", strerror(errno));
+		return 1;
 	}
+	signal_source.handler = signal_input;
+	return loop_add(signal_fd, &signal_source);
+}
 
-out:
-	memcpy(last, report, size);
+/* the device a control command is for, by position or by name */
+static struct device *control_device(const char *arg, FILE *reply)
+{
+	char *end;
+	long id;
+	int i;
+
+	id = strtol(arg, &end, 10);
+	if (*end == 0 && id >= 0 && id < device_count &&
+	    devices[id].mapping)
+		return &devices[id];
+	for (i = 0; i < device_count; i++)
+		if (devices[i].mapping && !strcmp(devices[i].name, arg))
+			return &devices[i];
+	fprintf(reply, "no device %s\n", arg);
+	return NULL;
+}
+
+static int control_list(int argc, char **argv, FILE *reply)
+{
+	struct device *dev;
+	int i, l;
+
+	for (i = 0; i < device_count; i++) {
+		dev = &devices[i];
+		if (dev->mapping == NULL)
+			continue;
+		fprintf(reply, "%u \"%s\" %04x:%04x %s %s, layer %s of",
+			dev->id, dev->name, dev->vendor, dev->product,
+			dev->method == METHOD_EVDEV ? "evdev" : "hidraw",
+			dev->fd >= 0 ? "attached" : "detached",
+			dev->active->name);
+		for (l = 0; l <= dev->mapping->nlayers; l++)
+			fprintf(reply, " %s", mapping_layer(dev->mapping, l)->name);
+		if (dev->sinks & SINK_RING)
+			fprintf(reply, ", ring %s%s", dev->ring_name,
+				dev->sinks & SINK_UINPUT ? "" : " only");
+		fprintf(reply, "\n");
+	}
+	return 0;
+}
+
+static int control_layer(int argc, char **argv, FILE *reply)
+{
+	struct device *dev = control_device(argv[1], reply);
+	char *end;
+	long layer;
+	int l;
+
+	if (dev == NULL)
+		return 1;
+	for (l = 0; l <= dev->mapping->nlayers; l++)
+		if (!strcmp(mapping_layer(dev->mapping, l)->name, argv[2]))
+			return device_set_layer(dev, l);
+	layer = strtol(argv[2], &end, 10);
+	if (*end || layer < 0 || device_set_layer(dev, layer)) {
+		fprintf(reply, "no layer %s\n", argv[2]);
+		return 1;
+	}
+	return 0;
+}
+
+static int control_key(int argc, char **argv, FILE *reply)
+{
+	struct device *dev = control_device(argv[1], reply);
+	char *end;
+	long key;
+	int ret;
+
+	if (dev == NULL)
+		return 1;
+	key = strtol(argv[2], &end, 10);
+	if (*end || key < 0 || key >= XKEYS_MAX_KEYS) {
+		fprintf(reply, "no key %s\n", argv[2]);
+		return 1;
+	}
+	if (!strcmp(argv[3], "press"))
+		ret = device_inject_key(dev, key, 1);
+	else if (!strcmp(argv[3], "release"))
+		ret = device_inject_key(dev, key, 0);
+	else if (!strcmp(argv[3], "tap"))
+		ret = device_inject_key(dev, key, 1) ||
+		      device_inject_key(dev, key, 0);
+	else {
+		fprintf(reply, "either press, release or tap\n");
+		return 1;
+	}
+	if (ret)
+		fprintf(reply, "device \"%s\" is not in use\n", dev->name);
 	return ret;
-send:
-	ret = write_input_event(dev, type, code, value);
-	goto out;
+}
+
+static int control_dial(int argc, char **argv, FILE *reply)
+{
+	struct device *dev = control_device(argv[1], reply);
+	char *end;
+	long value;
+	int axle;
+
+	if (dev == NULL)
+		return 1;
+	if (!strcmp(argv[2], "idial"))
+		axle = 0;
+	else if (!strcmp(argv[2], "edial"))
+		axle = 1;
+	else {
+		fprintf(reply, "either idial or edial\n");
+		return 1;
+	}
+	value = strtol(argv[3], &end, 10);
+	if (*end || value < -127 || value > 127) {
+		fprintf(reply, "invalid motion %s\n", argv[3]);
+		return 1;
+	}
+	if (device_inject_dial(dev, axle, value)) {
+		fprintf(reply, "device \"%s\" is not in use\n", dev->name);
+		return 1;
+	}
+	return 0;
+}
+
+static int control_stats(int argc, char **argv, FILE *reply)
+{
+	struct device *dev;
+	int i;
+
+	if (argc == 2) {
+		dev = control_device(argv[1], reply);
+		if (dev == NULL)
+			return 1;
+		device_print_stats(dev, reply);
+		return 0;
+	}
+	for (i = 0; i < device_count; i++)
+		if (devices[i].mapping)
+			device_print_stats(&devices[i], reply);
+	return 0;
+}
+
+static int control_reload(int argc, char **argv, FILE *reply)
+{
+	reload_config();
+	return 0;
+}
+
+static const struct {
+	const char *name;
+	int min_args, max_args;
+	int (*run)(int argc, char **argv, FILE *reply);
+	const char *usage;
+} control_commands[] = {
+	{ "list", 0, 0, control_list, "list" },
+	{ "layer", 2, 2, control_layer, "layer <device> <layer>" },
+	{ "key", 3, 3, control_key, "key <device> <key> press|release|tap" },
+	{ "dial", 3, 3, control_dial, "dial <device> idial|edial <motion>" },
+	{ "stats", 0, 1, control_stats, "stats [device]" },
+	{ "reload", 0, 0, control_reload, "reload" },
+};
+#define NCONTROL_COMMANDS (sizeof(control_commands) / sizeof(control_commands[0]))
+
+static int control_command(int argc, char **argv, FILE *reply)
+{
+	int i;
+
+	for (i = 0; i < NCONTROL_COMMANDS; i++) {
+		if (strcmp(argv[0], control_commands[i].name))
+			continue;
+		if (argc - 1 < control_commands[i].min_args ||
+		    argc - 1 > control_commands[i].max_args) {
+			fprintf(reply, "usage: %s\n", control_commands[i].usage);
+			return 1;
+		}
+		return control_commands[i].run(argc, argv, reply);
+	}
+	fprintf(reply, "unknown command %s, one of:\n", argv[0]);
+	for (i = 0; i < NCONTROL_COMMANDS; i++)
+		fprintf(reply, "  %s\n", control_commands[i].usage);
+	return 1;
 }
 
 static void help(void)
 {
-	printf("xkeysd [-c config] [-d] [-h]\n");
+	printf("xkeysd [-c config] [-d] [-h] [--cache file|--no-cache] [--control socket [--control-group group]|--no-control] [--uring] [--record file] [--replay file [--fast]]\n");
 	printf("\t-c <config>\tuse alternate config file\n");
 	printf("\t-d\t\tbecome a daemon and detach from the controlling terminal\n");
 	printf("\t-h\t\thelp\n");
+	printf("\t--cache <file>\tkeep the parsed configuration in file (default %s)\n", CACHE_FILE);
+	printf("\t--no-cache\talways parse the configuration file\n");
+	printf("\t--control <socket>\tlisten for xkeysctl on socket (default %s)\n", CONTROL_FILE);
+	printf("\t--control-group <group>\tlet the members of group use the control socket too\n");
+	printf("\t--no-control\tdon't listen for xkeysctl\n");
+	printf("\t--uring\t\tread the devices and write events using io_uring\n");
+	printf("\t--record <file>\tappend every report read from the devices to file\n");
+	printf("\t--replay <file>\tfeed the reports recorded in file instead of reading the devices\n");
+	printf("\t--fast\t\treplay as fast as possible instead of at the original speed\n");
 }
 
-/* max number of event devices grabbed */
-#define EV_FDS_SIZE 10
 int main(int argc, char *argv[])
 {
-	int ret, i, highest, opt, d = 0;
-	fd_set read;
-	char last[HID_MAX_DESCRIPTOR_SIZE];
-	int ev_fds[EV_FDS_SIZE];
-	struct timeval timeout;
+	int ret, i, opt, d = 0;
 	const char *options = "c:dh";
-	char *filename = NULL;
-
-	while ((opt = getopt(argc, argv, options)) != -1) {
+	static const struct option long_options[] = {
+		{ "record", required_argument, NULL, 'R' },
+		{ "replay", required_argument, NULL, 'P' },
+		{ "fast", no_argument, NULL, 'F' },
+		{ "cache", required_argument, NULL, 'C' },
+		{ "no-cache", no_argument, NULL, 'N' },
+		{ "uring", no_argument, NULL, 'U' },
+		{ "control", required_argument, NULL, 'S' },
+		{ "no-control", no_argument, NULL, 'n' },
+		{ "control-group", required_argument, NULL, 'G' },
+		{ NULL, 0, NULL, 0 },
+	};
+	char *filename = NULL, *record = NULL, *replay = NULL;
+	char *control = CONTROL_FILE;
+	char *control_group = NULL;
+	int fast = 0, uring = 0;
+
+	while ((opt = getopt_long(argc, argv, options, long_options, NULL)) != -1) {
 		switch (opt) {
+		case 'R':
+			record = strdup(optarg);
+			break;
+		case 'P':
+			replay = strdup(optarg);
+			break;
+		case 'F':
+			fast = 1;
+			break;
+		case 'C':
+			cache_filename = strdup(optarg);
+			break;
+		case 'N':
+			cache_filename = NULL;
+			break;
+		case 'U':
+			uring = 1;
+			break;
+		case 'S':
+			control = strdup(optarg);
+			break;
+		case 'n':
+			control = NULL;
+			break;
+		case 'G':
+			control_group = strdup(optarg);
+			break;
 		case 'c':
 			filename = strdup(optarg);
 			break;
@@ -739,15 +1627,21 @@ int main(int argc, char *argv[])
 	}
 	if (filename == NULL)
 		filename = "/etc/xkeysd.conf";
+	/* daemon() changes directory, so keep the path usable for reloads */
+	config_filename = realpath(filename, NULL);
+	if (config_filename == NULL)
+		config_filename = filename;
 
 	if (d) {
 		if (daemon(0, 0) == -1) {
 			log_err("Error forking process (%s)\n", strerror(errno));
 			return 1;
 		}
+		run_as_daemon = 1;
+		log_init();
 	}
 
-	ret = read_config(filename);
+	ret = load_config(devices, &device_count);
 	if (ret != 0) {
 		log_err("Error reading the configuration file (%s)\n",
 			filename);
@@ -759,7 +1653,41 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	if (grab_devices(ev_fds, EV_FDS_SIZE) < 0) {
+	if (replay) {
+		/*
+		 * the devices are not used, only their uinput counterparts.
+		 * only hidraw reports are recorded
+		 */
+		for (i = 0; i < device_count; i++)
+			if (devices[i].method == METHOD_HIDRAW &&
+			    (find_model(&devices[i]) || sinks_init(&devices[i]))) {
+				log_err("Error creating uinput device or ring for device \"%s\"\n",
+					devices[i].name);
+				return 1;
+			}
+		return replay_file(replay, devices, device_count, fast);
+	}
+
+	if (record && record_open(record))
+		return 1;
+
+	/* listen for hotplug events before looking, so nothing gets missed */
+	if (loop_init() || signals_init() || timers_init() ||
+	    hotplug_init(hotplug_event))
+		return 1;
+
+	if (uring && uring_init())
+		log("Using read() and write() instead of io_uring\n");
+	if (control && control_init(control, control_group, control_command))
+		log("Running without the control socket\n");
+
+	if (sysfs_scan(SYSFS_ROOT, &sysfs_index)) {
+		log_err("Unable to scan %s for devices (%s)\n", SYSFS_ROOT,
+			strerror(errno));
+		return 1;
+	}
+
+	if (grab_devices() < 0) {
 		log_err("Unable to grab devices, exiting\n");
 		return 1;
 	}
@@ -772,35 +1700,13 @@ int main(int argc, char *argv[])
 				strerror(errno));
 			if (errno == EPERM)
 				return 1;
-		}
-		else if (uinput_init(&devices[i])) {
-			log_err("Error creating uinput device for device \"%s\", not using device\n",
-				strlen(devices[i].name) ? devices[i].name:"noname",
-				strerror(errno));
-			close(devices[i].fd);
-			devices[i].fd = -1;
-		}
-	}
-
-	memset(last, 0, sizeof(last));
-	while(1) {
-		highest = select_init(&read, devices, device_count);
-		timeout.tv_sec = 1;
-		timeout.tv_usec = 0;
-		ret = select(highest + 1, &read, NULL, NULL, &timeout);	
-		if (ret == 0)
+			/* might show up later */
 			continue;
-		if (ret < 0) {
-			log_err("Error waiting for file descriptors to become available (%s)\n", strerror(errno));
-			return 1;
-		}
-		for (i = 0; i < device_count; i++) {
-			if (FD_ISSET(devices[i].fd, &read))
-				if (device_input(&devices[i], last))
-					return 1;
 		}
+		start_device(&devices[i]);
 	}
 
-	return 0;
+	return loop_run();
 }
 
+
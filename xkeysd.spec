@@ -57,6 +57,7 @@ fi
 %defattr(-,root,root,-)
 %doc AUTHORS LICENSE sample.conf
 %{_sbindir}/xkeysd
+%{_sbindir}/xkeysctl
 %{_sysconfdir}/rc.d/init.d/xkeysd
 
 %changelog